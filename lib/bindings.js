@@ -1 +1,26 @@
-module.exports = require('../build/Release/ole_bindings')
+const ole = require('../build/Release/ole_bindings')
+
+function fetchBatch (enumerator, batchSize) {
+  return new Promise((resolve, reject) => {
+    ole.fetchBatch(enumerator, batchSize, (err, items) => err ? reject(err) : resolve(items))
+  })
+}
+
+// for await (const batch of ole.iterate(collection, { batchSize })) ...
+// Batches are fetched off the loop thread, the next one while the current one is processed
+ole.iterate = async function * (collection, { batchSize = 256 } = {}) {
+  const enumerator = ole.enumerate(collection)
+  let pending = fetchBatch(enumerator, batchSize)
+  try {
+    while (pending) {
+      const batch = await pending
+      pending = batch.length < batchSize ? null : fetchBatch(enumerator, batchSize)
+      if (batch.length > 0) yield batch
+    }
+  } finally {
+    // the consumer stopped early, drop the prefetched batch
+    if (pending) pending.catch(() => {})
+  }
+}
+
+module.exports = ole
@@ -1,5 +1,16 @@
 const ole = require('./bindings')
 
+// out parameters of GetTestParameterInfo, in call order
+const parameterInfoTypes = {
+  name: 'string',
+  value: 'string',
+  unit: 'string',
+  upperlimit: 'string',
+  lowerlimit: 'string',
+  type: 'string',
+  mode: 'string'
+}
+
 class XTTReader {
   constructor () {
     this.comp = new ole.Object('QSPR3XTT.reader')
@@ -31,41 +42,25 @@ class XTTReader {
   }
 
   getTestInfo (testIndex) {
-    let testname = new ole.Variant('', 'pstring')
-    let realname = new ole.Variant('', 'pstring')
-    let numParams = new ole.Variant(0, 'pint')
-    this.comp.GetTestInfo(testIndex, testname, realname, numParams)
-
-    return [testname.valueOf(), realname.valueOf(), numParams.valueOf()]
+    return this.comp.invokeOut('GetTestInfo', [testIndex], ['string', 'string', 'int'])
   }
 
   getTestParameterInfo (testIndex, ParameterIndex) {
-    let parameterName = new ole.Variant('', 'pstring')
-    let parameterValue = new ole.Variant('', 'pstring')
-    let unit = new ole.Variant('', 'pstring')
-    let upperlimit = new ole.Variant('', 'pstring')
-    let lowerlimit = new ole.Variant('', 'pstring')
-    let DataType = new ole.Variant('', 'pstring')
-    let paramMode = new ole.Variant('', 'pstring')
-    this.comp.GetTestParameterInfo(testIndex, ParameterIndex, parameterName, parameterValue, unit, upperlimit, lowerlimit, DataType, paramMode)
+    return this.comp.invokeOut('GetTestParameterInfo', [testIndex, ParameterIndex], parameterInfoTypes)
+  }
 
-    return {
-      name: parameterName.valueOf(),
-      value: parameterValue.valueOf(),
-      unit: unit.valueOf(),
-      upperlimit: upperlimit.valueOf(),
-      lowerlimit: lowerlimit.valueOf(),
-      type: DataType.valueOf(),
-      mode: paramMode.valueOf()
-    }
+  getTestParameterInfoAsync (testIndex, ParameterIndex) {
+    return new Promise((resolve, reject) => {
+      this.comp.invokeOut('GetTestParameterInfo', [testIndex, ParameterIndex], parameterInfoTypes, (err, info) => {
+        if (err) reject(err)
+        else resolve(info)
+      })
+    })
   }
 
   generateRSAKeys (seed) {
     if (seed === undefined) seed = 'node_qia'
-    let publicKey = new ole.Variant('', 'pstring')
-    let privateKey = new ole.Variant('', 'pstring')
-    this.comp.GeneratePublicPrivateRSAKeys(seed, publicKey, privateKey)
-    return [publicKey.valueOf(), privateKey.valueOf()]
+    return this.comp.invokeOut('GeneratePublicPrivateRSAKeys', [seed], ['string', 'string'])
   }
 
   signXTTFile (inFile, outFile, privateKey) {
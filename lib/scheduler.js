@@ -13,8 +13,50 @@ const TestMsgEvents = [
   'FOLDER_END'
 ]
 
+function testMsgIndex (name) {
+  const index = TestMsgEvents.indexOf(name)
+  if (index < 0) throw new TypeError(`unknown test message '${name}'`)
+  return index
+}
+
+// translate scheduler options into native event filters, evaluated before events reach JS
+//   minTraceLevel: drop OnDebugMessage below this trace level
+//   testMessages: only deliver these OnTestMsg events, e.g. ['TEST_RESULT', 'UNIT_END']
+function eventFilters (options) {
+  let filters = {}
+  if (options.minTraceLevel !== undefined) {
+    filters.OnDebugMessage = [{ arg: 2, ge: options.minTraceLevel }]
+  }
+  if (options.testMessages) {
+    filters.OnTestMsg = [{ arg: 0, in: options.testMessages.map(testMsgIndex) }]
+  }
+  return filters
+}
+
+// translate stop rules into native rules on OnTestMsg, evaluated on the event thread
+//   { failures: 3, per: 'folder' }: stop after 3 failed TEST_RESULTs in a folder ('unit' counts per run)
+//   { nan: 'OutputParam_MeasuredValue' }: stop when this TEST_RESULT field is not a number
+// rules with a 'when' property are passed through unchanged
+function nativeStopRules (rules) {
+  const msg = testMsgIndex
+  const result = { arg: 0, eq: msg('TEST_RESULT') }
+  return rules.map(rule => {
+    if (rule.when) return rule
+    if (rule.failures) {
+      const reset = rule.per === 'unit'
+        ? { arg: 0, eq: msg('UNIT_START') }
+        : { arg: 0, in: [msg('FOLDER_START'), msg('FOLDER_END')] }
+      return { when: result, reset, bag: 1, field: 'TestResult', eq: 'Failed', count: rule.failures }
+    }
+    if (rule.nan) {
+      return { when: result, bag: 1, field: rule.nan, nan: true }
+    }
+    throw new TypeError('unknown stop rule')
+  })
+}
+
 class Scheduler extends EventEmitter {
-  constructor () {
+  constructor (options = {}) {
     super()
     this.comp = new ole.Object('QSPR.Scheduler')
     this.tree = null
@@ -23,8 +65,11 @@ class Scheduler extends EventEmitter {
     let that = this
     this.cookie = this.comp.callbackAdvise({
       __interface: 'ISchedulerEvents',
+      __bags: { OnTestMsg: 1 },
+      __filters: eventFilters(options),
+      __mirror: { OnGlobalVariableChanged: { key: 0, value: 1 } },
+      __series: { OnRealTimeParamMessage: { key: 1, value: 3, capacity: options.seriesCapacity || 4096 } },
       OnDebugMessage: (...args) => that.onDebugMessage(...args),
-      OnRealTimeParamMessage: (...args) => that.onRealTimeParamMessage(...args),
       OnTestMsg: (...args) => that.onTestMsg(...args),
       OnGlobalVariableChanged: (...args) => that.onGlobalVariableChanged(...args)
     })
@@ -38,24 +83,15 @@ class Scheduler extends EventEmitter {
     this.emit('DEBUG_MSG', strWin, strText, traceLevel, NoEndOfLine)
   }
 
-  onRealTimeParamMessage (messageType, id, name, value, units, lowerLimit, upperLimit, pluginTypes, pluginNames) {
-    // this event seems never fired
-  }
-
   onTestMsg (messageType, messageData) {
     if (messageType > TestMsgEvents.length) {
       // should not happen
       return
     }
 
+    // messageData arrives already materialized (see __bags)
     const evtname = TestMsgEvents[messageType]
-    let msg = {}
-    const names = messageData.GetItemNames()
-    for (let name of names) {
-      let val = messageData.GetValue(name)
-      msg[name] = val
-    }
-    this.emit(evtname, msg)
+    this.emit(evtname, messageData)
   }
 
   onGlobalVariableChanged (gvName, gvValue) {
@@ -69,7 +105,7 @@ class Scheduler extends EventEmitter {
         if (err) {
           reject(err)
         } else {
-          this.tree = new TestTree(ret, path)
+          this.tree = new TestTree(ret, path, this)
           resolve(this.tree)
         }
       })
@@ -83,7 +119,7 @@ class Scheduler extends EventEmitter {
         if (err) {
           reject(err)
         } else {
-          this.tree = new TestTree(ret, '')
+          this.tree = new TestTree(ret, '', this)
           resolve(this.tree)
         }
       })
@@ -98,14 +134,51 @@ class Scheduler extends EventEmitter {
     return this.comp.ErrorsExist ? this.comp.LastError : null
   }
 
+  // served from the native mirror kept current by OnGlobalVariableChanged,
+  // the server is only asked the first time a variable is read
   getGlobalVar (name) {
-    let val = new ole.Variant('', 'pstring')
-    this.comp.GetGlobalVariable(name, val)
-    return val.valueOf()
+    let val = this.comp.callbackMirror(this.cookie, name)
+    if (val === undefined) {
+      let ref = new ole.Variant('', 'pstring')
+      this.comp.GetGlobalVariable(name, ref)
+      val = ref.valueOf()
+      this.comp.callbackMirror(this.cookie, name, val)
+    }
+    return val
   }
 
   setGlobalVar (name, val) {
     this.comp.SetGlobalVariable(name, val)
+    this.comp.callbackMirror(this.cookie, name, undefined)
+  }
+
+  // increments on every OnGlobalVariableChanged, cheap to poll
+  globalVarVersion () {
+    return this.comp.callbackMirrorVersion(this.cookie)
+  }
+
+  // OnRealTimeParamMessage values are recorded natively per parameter id (see __series)
+  realTimeParamIds () {
+    return this.comp.callbackSeries(this.cookie)
+  }
+
+  // { time: Float64Array, value: Float64Array }, times in ms on the process.hrtime() clock
+  // options: { from, to, buckets } - buckets > 0 min-max decimates to at most 2 * buckets points
+  realTimeParamSeries (id, options) {
+    return this.comp.callbackSeries(this.cookie, String(id), options || {})
+  }
+
+  clearRealTimeParams (id) {
+    this.comp.callbackSeriesClear(this.cookie, id === undefined ? undefined : String(id))
+  }
+
+  // StopTest is called on the tree straight from the event thread when a rule matches
+  setStopRules (tree, rules) {
+    this.comp.callbackStopRules(this.cookie, 'OnTestMsg', tree.comp, 'StopTest', nativeStopRules(rules || []))
+  }
+
+  stopRulesState () {
+    return this.comp.callbackStopRules(this.cookie)
   }
 
   loadWorkspaceConfig (path) {
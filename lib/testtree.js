@@ -1,9 +1,10 @@
 const ole = require('./bindings')
 
 class TestTree {
-  constructor (comp, path) {
+  constructor (comp, path, scheduler) {
     this.comp = comp
     this.path = path
+    this.scheduler = scheduler
   }
 
   save (pathname) {
@@ -36,49 +37,30 @@ class TestTree {
   }
 
   async _run (timeout, func, ...args) {
-    let finished = false
-    let result
-    const cookie = this.comp.callbackAdvise({
-      __interface: 'ITestTreeEvents',
-      RunTreeDone (treePassed) {
-        finished = true
-        result = treePassed
-      }
-    })
-
-    this.comp[func](...args)
-
-    const stamp = Date.now()
-
-    const waitFinish = () => {
-      return new Promise((resolve, reject) => {
-        const checkFinshFlag = () => {
-          if (finished) {
-            resolve()
-          } else {
-            if (timeout) {
-              if (Date.now() - stamp > timeout) {
-                reject(new Error('timeout'))
-                return
-              }
-            }
-            setImmediate(checkFinshFlag)
-          }
-        }
-        setImmediate(checkFinshFlag)
-      })
+    // resolved natively when RunTreeDone arrives, rejected with 'timeout' after the deadline
+    const done = this.comp.callbackAdviseOnce('ITestTreeEvents', 'RunTreeDone', timeout || 0)
+    try {
+      this.comp[func](...args)
+    } catch (err) {
+      done.cancel()
+      done.catch(() => {})
+      throw err
     }
 
-    await waitFinish()
-    this.comp.callbackUnadvise(cookie)
-
-    return result
+    const [treePassed] = await done
+    return treePassed
   }
 
   stopTest () {
     return this._promiseWrap('StopTest')
   }
 
+  // e.g. [{ failures: 3, per: 'folder' }, { nan: 'OutputParam_MeasuredValue' }], [] removes them
+  setStopRules (rules) {
+    if (!this.scheduler) throw new Error('test tree not opened by a scheduler')
+    this.scheduler.setStopRules(this, rules)
+  }
+
   pauseTree () {
     return this._promiseWrap('PauseTree')
   }
@@ -6,8 +6,9 @@
 
 #include "disp.h"
 
-Persistent<ObjectTemplate> VariantObject::inst_template;
-Persistent<FunctionTemplate> VariantObject::clazz_template;
+thread_local Persistent<ObjectTemplate> VariantObject::inst_template;
+thread_local Persistent<FunctionTemplate> VariantObject::clazz_template;
+thread_local std::set<VariantObject*> VariantObject::instances;
 
 
 //-------------------------------------------------------------------------------------------------------
@@ -69,7 +70,7 @@ static vtypes_t vtypes({
 	{ L"byref", VT_BYREF }
 });
 
-bool VariantObject::assign(Isolate *isolate, Local<Value> &val, Local<Value> &type) {
+VARTYPE VariantObject::ParseType(const Local<Value> &type) {
 	VARTYPE vt = VT_EMPTY;
 	if (!type.IsEmpty()) {
 		if (type->IsString()) {
@@ -91,6 +92,11 @@ bool VariantObject::assign(Isolate *isolate, Local<Value> &val, Local<Value> &ty
 			vt |= type->Int32Value();
 		}
 	}
+	return vt;
+}
+
+bool VariantObject::assign(Isolate *isolate, Local<Value> &val, Local<Value> &type) {
+	VARTYPE vt = ParseType(type);
 
 	if (val.IsEmpty()) {
 		if FAILED(value.ChangeType(vt)) return false;
@@ -130,6 +136,7 @@ bool VariantObject::assign(Isolate *isolate, Local<Value> &val, Local<Value> &ty
 }
 
 VariantObject::VariantObject(const FunctionCallbackInfo<Value> &args) {
+	instances.insert(this);
 	Local<Value> val, type;
 	int argcnt = args.Length();
 	if (argcnt > 0) val = args[0];
@@ -165,6 +172,16 @@ void VariantObject::NodeInit(const Local<Object> &target) {
 	NODE_DEBUG_MSG("VariantObject initialized");
 }
 
+void VariantObject::NodeCleanup() {
+	// values may hold interfaces, release them before COM is uninitialized
+	for (VariantObject *self : instances) {
+		self->value.Clear();
+		self->pvalue.Clear();
+	}
+	inst_template.Reset();
+	clazz_template.Reset();
+}
+
 Local<Object> VariantObject::NodeCreateInstance(const FunctionCallbackInfo<Value> &args) {
 	Local<Object> self;
 	Isolate *isolate = args.GetIsolate();
@@ -175,6 +192,17 @@ Local<Object> VariantObject::NodeCreateInstance(const FunctionCallbackInfo<Value
 	return self;
 }
 
+Local<Object> VariantObject::NodeCreateView(Isolate *isolate, VARIANT &value) {
+	Local<Object> self;
+	if (!inst_template.IsEmpty()) {
+		self = inst_template.Get(isolate)->NewInstance();
+		VariantObject *view = new VariantObject();
+		view->value.Attach(&value);
+		view->Wrap(self);
+	}
+	return self;
+}
+
 void VariantObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 	Isolate *isolate = args.GetIsolate();
 	Local<Object> &self = args.This();
@@ -227,7 +255,42 @@ void VariantObject::NodeValueOf(const FunctionCallbackInfo<Value>& args) {
 		isolate->ThrowException(DispErrorInvalid(isolate));
 		return;
 	}
-	Local<Value> result = Variant2Value(isolate, self->value, true);
+	// valueOf({ typedArrays: true }) overrides ole.options() for this conversion
+	ConvertOptions opts = ConvertOptions::Current();
+	if (args.Length() > 0) opts.Read(args[0]);
+	ConvertOptions::Scope scope(opts);
+	// an array converts in full here, only nested arrays may stay lazy
+	Local<Value> result = ((self->value.vt & VT_ARRAY) != 0) ? Variant2Array(isolate, self->value, false) : Variant2Value(isolate, self->value, true);
+	args.GetReturnValue().Set(result);
+}
+
+// slice([start[, end]]) -> converts only that window of the array, indexes as in Array.prototype.slice
+void VariantObject::NodeSlice(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	VariantObject *self = VariantObject::Unwrap<VariantObject>(args.This());
+	if (!self) {
+		isolate->ThrowException(DispErrorInvalid(isolate));
+		return;
+	}
+	if ((self->value.vt & VT_ARRAY) == 0) {
+		isolate->ThrowException(DispError(isolate, E_NOTIMPL, L"slice"));
+		return;
+	}
+	double cnt = (double)self->value.ArrayLength();
+	double start = (args.Length() > 0 && args[0]->IsNumber()) ? args[0]->IntegerValue() : 0;
+	double end = (args.Length() > 1 && args[1]->IsNumber()) ? args[1]->IntegerValue() : cnt;
+	if (start < 0) start += cnt;
+	if (end < 0) end += cnt;
+	if (start < 0) start = 0; else if (start > cnt) start = cnt;
+	if (end < 0) end = 0; else if (end > cnt) end = cnt;
+	LONG from = (LONG)start, count = (end > start) ? (LONG)(end - start) : 0;
+	Local<Array> result = Array::New(isolate, count);
+	for (LONG i = 0; i < count; i++) {
+		CComVariant value;
+		if SUCCEEDED(self->value.ArrayGet(from + i, value)) {
+			result->Set((uint32_t)i, Variant2ValueOwned(isolate, value, true));
+		}
+	}
 	args.GetReturnValue().Set(result);
 }
 
@@ -283,6 +346,9 @@ void VariantObject::NodeGet(Local<String> name, const PropertyCallbackInfo<Value
 	else if (_wcsicmp(id, L"toString") == 0) {
 		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeToString, args.This())->GetFunction());
 	}
+	else if (_wcsicmp(id, L"slice") == 0) {
+		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeSlice, args.This())->GetFunction());
+	}
 	else if (_wcsicmp(id, L"length") == 0) {
 		if ((self->value.vt & VT_ARRAY) != 0) {
 			args.GetReturnValue().Set((uint32_t)self->value.ArrayLength());
@@ -304,7 +370,7 @@ void VariantObject::NodeGetByIndex(uint32_t index, const PropertyCallbackInfo<Va
 	else {
 		CComVariant value;
 		if SUCCEEDED(self->value.ArrayGet((LONG)index, value)) {
-			result = Variant2Value(isolate, value);
+			result = Variant2ValueOwned(isolate, value, true);
 		}
 	}
 	args.GetReturnValue().Set(result);
@@ -112,6 +112,7 @@ public:
 	}
 
 	HRESULT GetProperty(DISPID dispid, LONG argcnt, VARIANT *args, VARIANT *value, EXCEPINFO *except = 0) {
+		CallArena::CountInvoke();
 		HRESULT hrcode = DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_PROPERTYGET, except);
 		return hrcode;
 	}
@@ -119,16 +120,19 @@ public:
 	HRESULT GetProperty(DISPID dispid, LONG index, VARIANT *value, EXCEPINFO *except = 0) {
 		CComVariant arg(index);
 		LONG argcnt = (index >= 0) ? 1 : 0;
+		CallArena::CountInvoke();
 		return DispInvoke(ptr, dispid, argcnt, &arg, value, DISPATCH_PROPERTYGET, except);
 	}
 
 	HRESULT SetProperty(DISPID dispid, LONG argcnt, VARIANT *args, VARIANT *value, EXCEPINFO *except = 0) {
+		CallArena::CountInvoke();
 		HRESULT hrcode = DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_PROPERTYPUT, except);
 		if FAILED(hrcode) value->vt = VT_EMPTY;
 		return hrcode;
 	}
 
     HRESULT ExecuteMethod(DISPID dispid, LONG argcnt, VARIANT *args, VARIANT *value, EXCEPINFO *except = 0) {
+        CallArena::CountInvoke();
         HRESULT hrcode = DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_METHOD, except);
         return hrcode;
     }
@@ -139,13 +143,18 @@ typedef std::shared_ptr<DispInfo> DispInfoPtr;
 class VariantObject : public ObjectWrap
 {
 public:
-	VariantObject() {};
-	VariantObject(const VARIANT &v) : value(v) {};
+	VariantObject() { instances.insert(this); };
+	VariantObject(const VARIANT &v) : value(v) { instances.insert(this); };
 	VariantObject(const FunctionCallbackInfo<Value> &args);
+	~VariantObject() { instances.erase(this); }
 
-	static Persistent<ObjectTemplate> inst_template;
-	static Persistent<FunctionTemplate> clazz_template;
+	// per isolate, every thread running the module has its own templates
+	static thread_local Persistent<ObjectTemplate> inst_template;
+	static thread_local Persistent<FunctionTemplate> clazz_template;
+	// live wrappers of the calling thread
+	static thread_local std::set<VariantObject*> instances;
 	static void NodeInit(const Local<Object> &target);
+	static void NodeCleanup();
 	static bool HasInstance(Isolate *isolate, const Local<Value> &obj) {
 		Local<FunctionTemplate> clazz = clazz_template.Get(isolate);
 		return !clazz.IsEmpty() && clazz->HasInstance(obj);
@@ -163,12 +172,17 @@ public:
 	}
 
 	static Local<Object> NodeCreateInstance(const FunctionCallbackInfo<Value> &args);
+	// 'string', 'pint', ... or a VARTYPE number, as accepted by new Variant(value, type)
+	static VARTYPE ParseType(const Local<Value> &type);
+	// lazy array view, takes over the value
+	static Local<Object> NodeCreateView(Isolate *isolate, VARIANT &value);
 	static void NodeCreate(const FunctionCallbackInfo<Value> &args);
 	static void NodeClear(const FunctionCallbackInfo<Value> &args);
 	static void NodeAssign(const FunctionCallbackInfo<Value> &args);
 	static void NodeCast(const FunctionCallbackInfo<Value> &args);
 	static void NodeValueOf(const FunctionCallbackInfo<Value> &args);
 	static void NodeToString(const FunctionCallbackInfo<Value> &args);
+	static void NodeSlice(const FunctionCallbackInfo<Value> &args);
 	static void NodeGet(Local<String> name, const PropertyCallbackInfo<Value> &args);
 	static void NodeSet(Local<String> name, Local<Value> value, const PropertyCallbackInfo<Value> &args);
 	static void NodeGetByIndex(uint32_t index, const PropertyCallbackInfo<Value> &args);
@@ -3,37 +3,80 @@ using Nan::Get;
 using Nan::New;
 using Nan::Has;
 
-DWORD DispatchCallback::g_threadID;
-uv_mutex_t    DispatchCallback::g_queue_mutex;
-std::queue<ThreadedCallbackInvokation *> DispatchCallback::g_queue;
-uv_async_t         DispatchCallback::g_async;
+// Sinks of every isolate, a sink may be released on any COM thread
+namespace {
+	uv_once_t sinks_once = UV_ONCE_INIT;
+	uv_mutex_t sinks_mutex;
+	std::map<Isolate*, std::set<DispatchCallback*>> sinks;
+
+	void InitSinks() {
+		uv_mutex_init(&sinks_mutex);
+	}
+}
 
 // DispatchCallback implementation
 DispatchCallback::DispatchCallback(const Local<Object> &obj, CLSID clsid, ITypeInfo* TypeInfo)
-: obj_(Isolate::GetCurrent(), obj)
+: isolate_(Isolate::GetCurrent())
+, queue_(CallbackQueue::Get(Isolate::GetCurrent()))
+, cookie_(0)
+, obj_(Isolate::GetCurrent(), obj)
 , clsid_(clsid)
 , TypeInfo_(TypeInfo)
-, pRefernce_(nullptr) {
+, pRefernce_(nullptr)
+, mirrorDispId_(DISPID_UNKNOWN)
+, seriesDispId_(DISPID_UNKNOWN) {
 	hrInit_ = loadMyTypeInfo();
+	uv_once(&sinks_once, InitSinks);
+	uv_mutex_lock(&sinks_mutex);
+	sinks[isolate_].insert(this);
+	uv_mutex_unlock(&sinks_mutex);
 }
 
 DispatchCallback::~DispatchCallback() {
+	uv_mutex_lock(&sinks_mutex);
+	auto it = sinks.find(isolate_);
+	if (it != sinks.end()) {
+		it->second.erase(this);
+		if (it->second.empty()) sinks.erase(it);
+	}
+	uv_mutex_unlock(&sinks_mutex);
 	if (TypeInfo_) TypeInfo_->Release();
+	functions_.clear();
 	obj_.Reset();
 	if (pRefernce_) *pRefernce_ = 1;
 }
 
-bool DispatchCallback::inMainThread() {
-	return g_threadID == GetCurrentThreadId();
-}
-
 HRESULT DispatchCallback::initHResult() const {
 	return hrInit_;
 }
 
+// walk { Method: spec } objects of the sink, passing the method DISPID to process
+template<typename T>
+HRESULT DispatchCallback::loadMethodSpecs(const Local<Object> &self, const char *key, T process) {
+	auto specsKey = New(key).ToLocalChecked();
+	if (!Nan::Has(self, specsKey).FromJust()) return S_OK;
+	auto specs = Nan::Get(self, specsKey).ToLocalChecked();
+	if (!specs->IsObject()) return S_OK;
+	auto specsObj = specs->ToObject();
+	auto names = Nan::GetOwnPropertyNames(specsObj).ToLocalChecked();
+	for (auto i = (uint32_t)0; i < names->Length(); i++) {
+		auto name = Nan::Get(names, i).ToLocalChecked();
+		String::Value vname(name);
+		LPOLESTR PropName[] = { (LPOLESTR)*vname };
+		DISPID PropertyID;
+		HRESULT hr = GetIDsOfNames(IID_NULL, PropName, 1, LOCALE_SYSTEM_DEFAULT, &PropertyID);
+		if (!SUCCEEDED(hr)) {
+			Nan::ThrowError(DispError(Isolate::GetCurrent(), hr, PropName[0]));
+			return hr;
+		}
+		process(PropertyID, Nan::Get(specsObj, name).ToLocalChecked());
+	}
+	return S_OK;
+}
+
 HRESULT DispatchCallback::loadMyTypeInfo() {
 	Nan::HandleScope scope;
-	HRESULT hr;
+	HRESULT hr = S_OK;
 
 	auto self = obj_.Get(Isolate::GetCurrent());
 
@@ -66,9 +109,66 @@ HRESULT DispatchCallback::loadMyTypeInfo() {
 		callbackNames_.insert(std::make_pair(PropertyID, callbacks[i]));
 	}
 
+	// arguments to be read as property bags on the calling thread: { Method: argIndex }
+	hr = loadMethodSpecs(self, "__bags", [this](DISPID dispid, const Local<Value> &spec) {
+		if (spec->IsUint32()) bagArgs_[dispid] = (int)spec->Uint32Value();
+	});
+	if (FAILED(hr)) return hr;
+
+	// argument predicates, events not matching all of them never leave the calling thread: { Method: [filter, ...] }
+	// a spec that does not parse fails the advise, dropping it would deliver every event
+	bool filters_valid = true;
+	hr = loadMethodSpecs(self, "__filters", [this, &filters_valid](DISPID dispid, const Local<Value> &spec) {
+		std::vector<ArgFilter> filters;
+		if (ArgFilter::Parse(spec, filters)) filters_[dispid] = filters;
+		else filters_valid = false;
+	});
+	if (FAILED(hr)) return hr;
+	if (!filters_valid) {
+		Nan::ThrowTypeError("__filters: every filter needs an argument index and an operator");
+		return E_INVALIDARG;
+	}
+
+	// values mirrored natively from one event: { Method: { key: argIndex, value: argIndex } }
+	hr = loadMethodSpecs(self, "__mirror", [this](DISPID dispid, const Local<Value> &spec) {
+		if (!spec->IsObject()) return;
+		auto key = Nan::Get(spec->ToObject(), New("key").ToLocalChecked()).ToLocalChecked();
+		auto value = Nan::Get(spec->ToObject(), New("value").ToLocalChecked()).ToLocalChecked();
+		if (!key->IsUint32() || !value->IsUint32()) return;
+		mirror_.reset(new VariantMirror(key->Uint32Value(), value->Uint32Value()));
+		mirrorDispId_ = dispid;
+	});
+	if (FAILED(hr)) return hr;
+
+	// numeric samples kept natively per key: { Method: { key: argIndex, value: argIndex, capacity: n } }
+	hr = loadMethodSpecs(self, "__series", [this](DISPID dispid, const Local<Value> &spec) {
+		if (!spec->IsObject()) return;
+		auto key = Nan::Get(spec->ToObject(), New("key").ToLocalChecked()).ToLocalChecked();
+		auto value = Nan::Get(spec->ToObject(), New("value").ToLocalChecked()).ToLocalChecked();
+		auto capacity = Nan::Get(spec->ToObject(), New("capacity").ToLocalChecked()).ToLocalChecked();
+		if (!key->IsUint32() || !value->IsUint32()) return;
+		size_t cap = (capacity->IsUint32() && capacity->Uint32Value() > 0) ? capacity->Uint32Value() : 4096;
+		series_.reset(new SeriesBuffer(key->Uint32Value(), value->Uint32Value(), cap));
+		seriesDispId_ = dispid;
+	});
+	if (FAILED(hr)) return hr;
+
+	bindCallbacks(self);
 	return hr;
 }
 
+// resolve handlers once, so dispatching an event is a table lookup
+// the set of DISPIDs is fixed at advise time, only the functions may be rebound
+void DispatchCallback::bindCallbacks(const Local<Object> &obj) {
+	auto isolate = Isolate::GetCurrent();
+	if (obj != obj_.Get(isolate)) obj_.Reset(isolate, obj);
+	functions_.clear();
+	for (auto &it : callbackNames_) {
+		auto val = Nan::Get(obj, New<String>((uint16_t*)it.second.c_str()).ToLocalChecked()).ToLocalChecked();
+		if (val->IsFunction()) functions_[it.first].Reset(isolate, Local<Function>::Cast(val));
+	}
+}
+
 HRESULT __stdcall DispatchCallback::QueryInterface(REFIID qiid, void **ppvObject) {
 	if (qiid == clsid_) { 
 		*ppvObject = this;
@@ -102,23 +202,45 @@ HRESULT STDMETHODCALLTYPE DispatchCallback::GetIDsOfNames(REFIID riid, LPOLESTR
 	return(DispGetIDsOfNames(TypeInfo_, rgszNames, cNames, rgDispId));
 }
 
-std::wstring DispatchCallback::getNameOfDispId(DISPID dispid) {
+bool DispatchCallback::isCallbackDispId(DISPID dispid) {
+	return callbackNames_.find(dispid) != callbackNames_.end();
+}
 
-	auto it = callbackNames_.find(dispid);
-	return it == callbackNames_.end() ? L"" : it->second;
+bool DispatchCallback::isNativeDispId(DISPID dispid) {
+	return (mirror_ && dispid == mirrorDispId_) || (series_ && dispid == seriesDispId_) || stopRules_.Handles(dispid);
 }
 
 HRESULT STDMETHODCALLTYPE DispatchCallback::Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr) {
-	// Prepare name by member id
-	std::wstring cname;
-	if (dispIdMember != DISPID_VALUE) {
-		cname = getNameOfDispId(dispIdMember);
-	}
+	uint64_t arrived = uv_hrtime();
 
-	if (cname.empty()) {
+	// Check member id
+	bool has_callback = isCallbackDispId(dispIdMember);
+	if (dispIdMember == DISPID_VALUE || (!has_callback && !isNativeDispId(dispIdMember))) {
 		return DISP_E_MEMBERNOTFOUND;
 	}
 
+	// Stop rules see every event, filtered or not
+	if ((wFlags & DISPATCH_METHOD) != 0) {
+		stopRules_.Process(dispIdMember, pDispParams);
+	}
+
+	// Drop filtered events before they wake the event loop
+	auto filterit = filters_.find(dispIdMember);
+	if (filterit != filters_.end() && !ArgFilter::MatchAll(filterit->second, pDispParams)) {
+		return S_OK;
+	}
+
+	// Native consumers, events without a handler end here
+	if (mirror_ && dispIdMember == mirrorDispId_ && (wFlags & DISPATCH_METHOD) != 0) {
+		mirror_->Update(pDispParams);
+	}
+	if (series_ && dispIdMember == seriesDispId_ && (wFlags & DISPATCH_METHOD) != 0) {
+		series_->Update(pDispParams, arrived);
+	}
+	if (!has_callback) {
+		return S_OK;
+	}
+
 	// Set property value
 	if ((wFlags & DISPATCH_PROPERTYPUT) != 0) {
 		return E_NOTIMPL;
@@ -133,39 +255,33 @@ HRESULT STDMETHODCALLTYPE DispatchCallback::Invoke(DISPID dispIdMember, REFIID r
 	if ((wFlags & DISPATCH_METHOD) != 0) {
 		CalllbackInfo cbinfo;
 		cbinfo.caller = this;
-		cbinfo.name = cname;
+		cbinfo.dispid = dispIdMember;
 		cbinfo.hrcode = S_OK;
 		cbinfo.pDispParams = pDispParams;
 		cbinfo.pVarResult = pVarResult;
 		cbinfo.refernce = 0;
+		cbinfo.bagArg = -1;
+		cbinfo.arrived = arrived;
+		cbinfo.dispatched = 0;
+
+		// read property bag argument here, so the main thread only builds the object
+		// a bag that cannot be read arrives empty, the handler always gets a plain object
+		auto bagit = bagArgs_.find(dispIdMember);
+		if (bagit != bagArgs_.end() && (UINT)bagit->second < pDispParams->cArgs) {
+			CComPtr<IDispatch> bagdisp;
+			VARIANT *bagvar = &pDispParams->rgvarg[pDispParams->cArgs - bagit->second - 1];
+			if (!VariantDispGet(bagvar, &bagdisp) || FAILED(cbinfo.bag.Read(bagdisp))) cbinfo.bag.Clear();
+			cbinfo.bagArg = bagit->second;
+		}
 
 		// refernce to as indicator , incase the object is unadvised in another thread
 		this->pRefernce_ = &cbinfo.refernce;
 
-		if (inMainThread()) {
+		// delivered on the loop that advised this sink
+		if (queue_->inLoopThread()) {
 			dispatchToV8(&cbinfo, false);
 		} else {
-			// hold the event loop open while this is executing
-			uv_mutex_lock(&g_queue_mutex);
-    		uv_ref((uv_handle_t *)&g_async);
-			uv_mutex_unlock(&g_queue_mutex);
-			// create a temporary storage area for our invokation parameters
-    		ThreadedCallbackInvokation inv(&cbinfo);
-
-			// push it to the queue -- threadsafe
-			uv_mutex_lock(&g_queue_mutex);
-			g_queue.push(&inv);
-			uv_mutex_unlock(&g_queue_mutex);
-
-			// send a message to our main thread to wake up the WatchCallback loop
-			uv_async_send(&g_async);
-
-			// wait for signal from calling thread
-			inv.WaitForExecution();
-
-			uv_mutex_lock(&g_queue_mutex);
-			uv_unref((uv_handle_t *)&g_async);
-			uv_mutex_unlock(&g_queue_mutex);
+			queue_->Call(&cbinfo);
 		}
 
 		return cbinfo.hrcode;
@@ -176,15 +292,45 @@ HRESULT STDMETHODCALLTYPE DispatchCallback::Invoke(DISPID dispIdMember, REFIID r
 
 
 NAN_MODULE_INIT(DispatchCallback::Initialize) {
+	Nan::SetMethod(target, "eventArrival", NodeEventArrival);
+}
 
-	// initialize our threaded invokation stuff
-  	g_threadID = GetCurrentThreadId();
+void DispatchCallback::Advised(IConnectionPoint *point, DWORD cookie) {
+	point_ = point;
+	cookie_ = cookie;
+}
 
-	uv_async_init(uv_default_loop(), &g_async, (uv_async_cb) WatcherCallback);
-	uv_mutex_init(&g_queue_mutex);
+// COM may hold a sink past its isolate, so the handles are dropped here rather than in the destructor
+void DispatchCallback::Cleanup(Isolate *isolate) {
+	CallbackQueue::Shutdown(isolate);
+	EventWaiter::Cleanup();
 
-	// allow the event loop to exit while this is running
-	uv_unref((uv_handle_t *)&g_async);
+	std::vector<std::pair<IConnectionPoint*, DWORD>> points;
+	uv_once(&sinks_once, InitSinks);
+	uv_mutex_lock(&sinks_mutex);
+	auto it = sinks.find(isolate);
+	if (it != sinks.end()) {
+		for (DispatchCallback *sink : it->second) {
+			if (sink->point_) points.push_back(std::make_pair(sink->point_.Detach(), sink->cookie_));
+			sink->functions_.clear();
+			sink->obj_.Reset();
+		}
+		sinks.erase(it);
+	}
+	uv_mutex_unlock(&sinks_mutex);
+
+	// unadvise outside the lock, the last release of a sink takes it in the destructor
+	for (auto &point : points) {
+		point.first->Unadvise(point.second);
+		point.first->Release();
+	}
+}
+
+// arrival time of the event being handled, in milliseconds on the process.hrtime() clock
+NAN_METHOD(DispatchCallback::NodeEventArrival) {
+	CallbackQueue *queue = CallbackQueue::Find(Isolate::GetCurrent());
+	if (!queue || queue->arrived == 0) return;
+	info.GetReturnValue().Set((double)queue->arrived / 1e6);
 }
 
 void DispatchCallback::dispatchToV8(CalllbackInfo *self, bool dispatched) {
@@ -195,30 +341,29 @@ void DispatchCallback::dispatchToV8(CalllbackInfo *self, bool dispatched) {
 	}
 
 	self->caller->pRefernce_ = nullptr;
+	self->dispatched = uv_hrtime();
+	self->caller->latency_.Add((self->dispatched - self->arrived) / 1000);
 
 	Nan::HandleScope scope;
 
 	auto isolate = Isolate::GetCurrent();
-	NodeArguments args(isolate, self->pDispParams, true);
-	int argcnt = (int)args.items.size();
-	Local<Value> *argptr = (argcnt > 0) ? &args.items[0] : nullptr;
-	Local<Object> object = self->caller->obj_.Get(isolate);
-
-	auto name = New<String>((uint16_t*)self->name.c_str()).ToLocalChecked();
-	auto val = object->Get(name);
+	auto &functions = self->caller->functions_;
+	auto it = functions.find(self->dispid);
 
 	Local<Value> ret;
 
-	if (val->IsFunction()) {
-		Local<Function> func = Local<Function>::Cast(val);
-		if (!func.IsEmpty()) {
-			ret = func->Call(object, argcnt, argptr);
-		} else {
-			if (dispatched) {
-				Nan::ThrowError("fatal: callback may be garbage collected!");
-			}
-			self->hrcode = DISP_E_BADCALLEE;
-		}
+	if (it != functions.end()) {
+		NodeArguments args(isolate, self->pDispParams, true, self->bagArg);
+		if (self->bagArg >= 0) args.items[self->bagArg] = self->bag.ToObject(isolate);
+		int argcnt = (int)args.items.size();
+		Local<Value> *argptr = (argcnt > 0) ? &args.items[0] : nullptr;
+		Local<Object> object = self->caller->obj_.Get(isolate);
+		Local<Function> func = it->second.Get(isolate);
+		CallbackQueue *queue = self->caller->queue_;
+		uint64_t outer = queue->arrived;
+		queue->arrived = self->arrived;
+		ret = func->Call(object, argcnt, argptr);
+		queue->arrived = outer;
 	} else {
 		if (dispatched) {
 			Nan::ThrowError("fatal: callback may be garbage collected!");
@@ -232,21 +377,557 @@ void DispatchCallback::dispatchToV8(CalllbackInfo *self, bool dispatched) {
 	}
 }
 
-void DispatchCallback::WatcherCallback(uv_async_t *w, int revents) {
-	uv_mutex_lock(&g_queue_mutex);
+/////////////////////////////////////////////////////////////////////////////////////////
+uv_once_t CallbackQueue::g_once = UV_ONCE_INIT;
+uv_mutex_t CallbackQueue::g_mutex;
+std::map<uv_loop_t*, CallbackQueue*> CallbackQueue::g_queues;
 
-	while (!g_queue.empty()) {
-		ThreadedCallbackInvokation *inv = g_queue.front();
-		g_queue.pop();
+uv_loop_t *CallbackQueue::LoopOf(Isolate *isolate) {
+#if NODE_MODULE_VERSION >= 64
+	return node::GetCurrentEventLoop(isolate);
+#else
+	return uv_default_loop();
+#endif
+}
 
-		dispatchToV8(inv->m_cbinfo, true);
+CallbackQueue *CallbackQueue::Find(Isolate *isolate) {
+	uv_once(&g_once, []() { uv_mutex_init(&g_mutex); });
+	uv_loop_t *loop = LoopOf(isolate);
+	uv_mutex_lock(&g_mutex);
+	auto it = g_queues.find(loop);
+	CallbackQueue *queue = (it != g_queues.end()) ? it->second : nullptr;
+	uv_mutex_unlock(&g_mutex);
+	return queue;
+}
+
+CallbackQueue *CallbackQueue::Get(Isolate *isolate) {
+	CallbackQueue *queue = Find(isolate);
+	if (queue) return queue;
+	uv_loop_t *loop = LoopOf(isolate);
+	queue = new CallbackQueue(loop);
+	uv_mutex_lock(&g_mutex);
+	g_queues[loop] = queue;
+	uv_mutex_unlock(&g_mutex);
+	return queue;
+}
+
+// created on the loop thread
+CallbackQueue::CallbackQueue(uv_loop_t *loop)
+: arrived(0)
+, loop_(loop)
+, threadID_(GetCurrentThreadId())
+, closed_(false) {
+	uv_mutex_init(&mutex_);
+	uv_async_init(loop_, &async_, OnAsync);
+	async_.data = this;
+
+	// allow the event loop to exit while this is running
+	uv_unref((uv_handle_t *)&async_);
+}
+
+void CallbackQueue::Call(CalllbackInfo *cbinfo) {
+	// create a temporary storage area for our invokation parameters
+	ThreadedCallbackInvokation inv(cbinfo);
+
+	// hold the event loop open while this is executing and push it to the queue -- threadsafe
+	uv_mutex_lock(&mutex_);
+	if (closed_) {
+		uv_mutex_unlock(&mutex_);
+		cbinfo->hrcode = DISP_E_BADCALLEE;
+		return;
+	}
+	uv_ref((uv_handle_t *)&async_);
+	queue_.push(&inv);
+	uv_mutex_unlock(&mutex_);
+
+	// wake up the loop thread
+	uv_async_send(&async_);
+
+	// wait for signal from calling thread
+	inv.WaitForExecution();
+
+	uv_mutex_lock(&mutex_);
+	if (!closed_) uv_unref((uv_handle_t *)&async_);
+	uv_mutex_unlock(&mutex_);
+}
+
+// sinks may still be advised from COM's side, so the queue itself is kept, only detached from its loop
+void CallbackQueue::Shutdown(Isolate *isolate) {
+	CallbackQueue *self = Find(isolate);
+	if (!self) return;
+	uv_mutex_lock(&g_mutex);
+	g_queues.erase(self->loop_);
+	uv_mutex_unlock(&g_mutex);
+
+	uv_mutex_lock(&self->mutex_);
+	self->closed_ = true;
+	while (!self->queue_.empty()) {
+		ThreadedCallbackInvokation *inv = self->queue_.front();
+		self->queue_.pop();
+		inv->m_cbinfo->hrcode = DISP_E_BADCALLEE;
+		inv->SignalDoneExecuting();
+	}
+	uv_close((uv_handle_t *)&self->async_, nullptr);
+	uv_mutex_unlock(&self->mutex_);
+}
+
+void CallbackQueue::OnAsync(uv_async_t *handle) {
+	CallbackQueue *self = (CallbackQueue*)handle->data;
+	uv_mutex_lock(&self->mutex_);
+
+	while (!self->queue_.empty()) {
+		ThreadedCallbackInvokation *inv = self->queue_.front();
+		self->queue_.pop();
+
+		DispatchCallback::dispatchToV8(inv->m_cbinfo, true);
 		inv->SignalDoneExecuting();
 	}
 
-	uv_mutex_unlock(&g_queue_mutex);
+	uv_mutex_unlock(&self->mutex_);
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////
+void LatencyHistogram::Reset() {
+	count = sum = max = 0;
+	memset(counts, 0, sizeof(counts));
+}
+
+int LatencyHistogram::BucketOf(uint64_t us) {
+	if (us < linear_buckets) return (int)us;
+	int msb = 4;
+	while ((us >> (msb + 1)) != 0) msb++;
+	int index = linear_buckets + (msb - 4) * sub_buckets + (int)((us >> (msb - 3)) & (sub_buckets - 1));
+	return index < buckets ? index : buckets - 1;
+}
+
+uint64_t LatencyHistogram::BucketLimit(int index) {
+	if (index < linear_buckets) return (uint64_t)index;
+	int msb = 4 + (index - linear_buckets) / sub_buckets;
+	uint64_t sub = (index - linear_buckets) % sub_buckets;
+	return ((sub_buckets + sub + 1) << (msb - 3)) - 1;
+}
+
+void LatencyHistogram::Add(uint64_t us) {
+	counts[BucketOf(us)]++;
+	count++;
+	sum += us;
+	if (us > max) max = us;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+	if (count == 0) return 0;
+	uint64_t rank = (uint64_t)(p * count + 0.5);
+	if (rank == 0) rank = 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < buckets; i++) {
+		seen += counts[i];
+		if (seen >= rank) {
+			uint64_t limit = BucketLimit(i);
+			return limit < max ? limit : max;
+		}
+	}
+	return max;
+}
+
+Local<Object> LatencyHistogram::ToObject(Isolate *isolate) const {
+	Local<Object> obj = Object::New(isolate);
+	obj->Set(String::NewFromUtf8(isolate, "count"), Number::New(isolate, (double)count));
+	obj->Set(String::NewFromUtf8(isolate, "mean"), Number::New(isolate, count ? (double)sum / count / 1000. : 0.));
+	obj->Set(String::NewFromUtf8(isolate, "p50"), Number::New(isolate, Percentile(0.5) / 1000.));
+	obj->Set(String::NewFromUtf8(isolate, "p99"), Number::New(isolate, Percentile(0.99) / 1000.));
+	obj->Set(String::NewFromUtf8(isolate, "max"), Number::New(isolate, max / 1000.));
+	return obj;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+VariantMirror::VariantMirror(UINT key_arg, UINT value_arg)
+: key_arg_(key_arg)
+, value_arg_(value_arg)
+, version_(0) {
+	uv_mutex_init(&mutex_);
+}
+
+VariantMirror::~VariantMirror() {
+	uv_mutex_destroy(&mutex_);
+}
+
+void VariantMirror::Update(const DISPPARAMS *params) {
+	UINT argcnt = params->cArgs;
+	if (key_arg_ >= argcnt || value_arg_ >= argcnt) return;
+	CComVariant key;
+	if (FAILED(VariantChangeType(&key, &params->rgvarg[argcnt - key_arg_ - 1], 0, VT_BSTR)) || !key.bstrVal) return;
+	std::wstring name(key.bstrVal, SysStringLen(key.bstrVal));
+
+	uv_mutex_lock(&mutex_);
+	CComVariant &value = values_[name];
+	value.Clear();
+	VariantCopyInd(&value, &params->rgvarg[argcnt - value_arg_ - 1]);
+	InterlockedIncrement(&version_);
+	uv_mutex_unlock(&mutex_);
+}
+
+// seeding never overwrites a value already delivered by an event
+bool VariantMirror::Seed(const std::wstring &key, const VARIANT &value) {
+	uv_mutex_lock(&mutex_);
+	bool inserted = values_.find(key) == values_.end();
+	if (inserted) VariantCopyInd(&values_[key], &value);
+	uv_mutex_unlock(&mutex_);
+	return inserted;
+}
+
+void VariantMirror::Remove(const std::wstring &key) {
+	uv_mutex_lock(&mutex_);
+	values_.erase(key);
+	uv_mutex_unlock(&mutex_);
+}
+
+bool VariantMirror::Get(const std::wstring &key, VARIANT *value) {
+	uv_mutex_lock(&mutex_);
+	auto it = values_.find(key);
+	bool found = it != values_.end();
+	if (found) VariantCopy(value, &it->second);
+	uv_mutex_unlock(&mutex_);
+	return found;
+}
+
+Local<Object> VariantMirror::ToObject(Isolate *isolate) {
+	Local<Object> obj = Object::New(isolate);
+	uv_mutex_lock(&mutex_);
+	for (auto &it : values_) {
+		obj->Set(String::NewFromTwoByte(isolate, (uint16_t*)it.first.c_str(), String::kNormalString, (int)it.first.length()), Variant2Value(isolate, it.second));
+	}
+	uv_mutex_unlock(&mutex_);
+	return obj;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+SeriesBuffer::SeriesBuffer(UINT key_arg, UINT value_arg, size_t capacity)
+: key_arg_(key_arg)
+, value_arg_(value_arg)
+, capacity_(capacity) {
+	uv_mutex_init(&mutex_);
+}
+
+SeriesBuffer::~SeriesBuffer() {
+	uv_mutex_destroy(&mutex_);
+}
+
+void SeriesBuffer::Update(const DISPPARAMS *params, uint64_t arrived) {
+	UINT argcnt = params->cArgs;
+	if (key_arg_ >= argcnt || value_arg_ >= argcnt) return;
+	double value = Variant2Double(params->rgvarg[argcnt - value_arg_ - 1], NAN);
+	if (std::isnan(value)) return;
+	CComVariant key;
+	if (FAILED(VariantChangeType(&key, &params->rgvarg[argcnt - key_arg_ - 1], 0, VT_BSTR)) || !key.bstrVal) return;
+	std::wstring name(key.bstrVal, SysStringLen(key.bstrVal));
+
+	uv_mutex_lock(&mutex_);
+	ring_t &ring = rings_[name];
+	if (ring.times.empty()) {
+		// allocated once per key, never grows
+		ring.times.resize(capacity_);
+		ring.values.resize(capacity_);
+		ring.head = ring.count = 0;
+	}
+	ring.times[ring.head] = arrived / 1e6;
+	ring.values[ring.head] = value;
+	ring.head = (ring.head + 1) % capacity_;
+	if (ring.count < capacity_) ring.count++;
+	uv_mutex_unlock(&mutex_);
+}
+
+void SeriesBuffer::Clear(const std::wstring *key) {
+	uv_mutex_lock(&mutex_);
+	if (key) rings_.erase(*key);
+	else rings_.clear();
+	uv_mutex_unlock(&mutex_);
+}
+
+Local<Array> SeriesBuffer::Keys(Isolate *isolate) {
+	uv_mutex_lock(&mutex_);
+	Local<Array> keys = Array::New(isolate, (int)rings_.size());
+	uint32_t i = 0;
+	for (auto &it : rings_) {
+		keys->Set(i++, String::NewFromTwoByte(isolate, (uint16_t*)it.first.c_str(), String::kNormalString, (int)it.first.length()));
+	}
+	uv_mutex_unlock(&mutex_);
+	return keys;
+}
+
+Local<Object> SeriesBuffer::Query(Isolate *isolate, const std::wstring &key, double from, double to, size_t buckets) {
+	std::vector<double> times, values;
+
+	uv_mutex_lock(&mutex_);
+	auto it = rings_.find(key);
+	if (it != rings_.end()) {
+		const ring_t &ring = it->second;
+		// samples are in arrival order, so the window is a contiguous run
+		size_t first = 0, last = ring.count;
+		while (first < last && ring.times[ring.index(first)] < from) first++;
+		while (last > first && ring.times[ring.index(last - 1)] > to) last--;
+		size_t count = last - first;
+
+		if (buckets == 0 || count <= buckets * 2) {
+			times.reserve(count);
+			values.reserve(count);
+			for (size_t i = first; i < last; i++) {
+				times.push_back(ring.times[ring.index(i)]);
+				values.push_back(ring.values[ring.index(i)]);
+			}
+		}
+		else {
+			// keep the extremes of every bucket in time order, so peaks survive the downsampling
+			times.reserve(buckets * 2);
+			values.reserve(buckets * 2);
+			for (size_t b = 0; b < buckets; b++) {
+				size_t begin = first + count * b / buckets, end = first + count * (b + 1) / buckets;
+				if (begin == end) continue;
+				size_t lo = begin, hi = begin;
+				for (size_t i = begin + 1; i < end; i++) {
+					double v = ring.values[ring.index(i)];
+					if (v < ring.values[ring.index(lo)]) lo = i;
+					if (v > ring.values[ring.index(hi)]) hi = i;
+				}
+				size_t a = (std::min)(lo, hi), z = (std::max)(lo, hi);
+				times.push_back(ring.times[ring.index(a)]);
+				values.push_back(ring.values[ring.index(a)]);
+				if (z != a) {
+					times.push_back(ring.times[ring.index(z)]);
+					values.push_back(ring.values[ring.index(z)]);
+				}
+			}
+		}
+	}
+	uv_mutex_unlock(&mutex_);
+
+	size_t bytes = times.size() * sizeof(double);
+	Local<ArrayBuffer> tbuf = ArrayBuffer::New(isolate, bytes);
+	Local<ArrayBuffer> vbuf = ArrayBuffer::New(isolate, bytes);
+	if (bytes > 0) {
+		memcpy(tbuf->GetContents().Data(), &times[0], bytes);
+		memcpy(vbuf->GetContents().Data(), &values[0], bytes);
+	}
+
+	Local<Object> obj = Object::New(isolate);
+	obj->Set(String::NewFromUtf8(isolate, "time"), Float64Array::New(tbuf, 0, times.size()));
+	obj->Set(String::NewFromUtf8(isolate, "value"), Float64Array::New(vbuf, 0, values.size()));
+	return obj;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+StopRules::StopRules()
+: dispid_(DISPID_UNKNOWN)
+, method_(DISPID_UNKNOWN)
+, fired_(0)
+, firedRule_(-1) {
+	uv_mutex_init(&mutex_);
+}
+
+StopRules::~StopRules() {
+	uv_mutex_destroy(&mutex_);
+}
+
+bool StopRules::Set(DISPID dispid, IDispatch *target, DISPID method, const Local<Value> &rules) {
+	static const struct { const char *name; rule_t::cond_t cond; } conds[] = {
+		{ "eq", rule_t::cond_eq }, { "ne", rule_t::cond_ne }, { "nan", rule_t::cond_nan }
+	};
+	if (!rules->IsArray()) return false;
+	std::vector<rule_t> parsed;
+	auto items = Local<Array>::Cast(rules);
+	for (uint32_t i = 0; i < items->Length(); i++) {
+		auto item = Nan::Get(items, i).ToLocalChecked();
+		if (!item->IsObject()) return false;
+		auto obj = item->ToObject();
+		rule_t rule;
+		rule.bagArg = -1;
+		rule.cond = rule_t::cond_any;
+		rule.limit = 1;
+		auto when = Nan::Get(obj, New("when").ToLocalChecked()).ToLocalChecked();
+		if (!when->IsUndefined() && !ArgFilter::Parse(when, rule.when)) return false;
+		auto reset = Nan::Get(obj, New("reset").ToLocalChecked()).ToLocalChecked();
+		if (!reset->IsUndefined() && !ArgFilter::Parse(reset, rule.reset)) return false;
+		auto count = Nan::Get(obj, New("count").ToLocalChecked()).ToLocalChecked();
+		if (count->IsUint32() && count->Uint32Value() > 0) rule.limit = (LONG)count->Uint32Value();
+		auto bag = Nan::Get(obj, New("bag").ToLocalChecked()).ToLocalChecked();
+		auto field = Nan::Get(obj, New("field").ToLocalChecked()).ToLocalChecked();
+		if (bag->IsUint32() && field->IsString()) {
+			String::Value vfield(field);
+			rule.bagArg = (int)bag->Uint32Value();
+			rule.field.assign((LPOLESTR)*vfield, vfield.length());
+			for (auto &cond : conds) {
+				auto key = New(cond.name).ToLocalChecked();
+				if (!Nan::Has(obj, key).FromJust()) continue;
+				rule.cond = cond.cond;
+				String::Value vtext(Nan::Get(obj, key).ToLocalChecked());
+				rule.text.assign((LPOLESTR)*vtext, vtext.length());
+				break;
+			}
+		}
+		parsed.push_back(rule);
+	}
+
+	bool armed = !parsed.empty();
+	uv_mutex_lock(&mutex_);
+	counts_.assign(parsed.size(), 0);
+	rules_ = std::make_shared<const std::vector<rule_t>>(std::move(parsed));
+	target_ = target;
+	method_ = method;
+	fired_ = 0;
+	firedRule_ = -1;
+	InterlockedExchange(&dispid_, armed ? dispid : DISPID_UNKNOWN);
+	uv_mutex_unlock(&mutex_);
+	return true;
+}
+
+bool StopRules::rule_t::Test(const DISPPARAMS *params) const {
+	if (cond == cond_any) return true;
+	if (bagArg < 0 || (UINT)bagArg >= params->cArgs) return false;
+
+	// only the field the rule looks at is read from the bag
+	CComPtr<IDispatch> bagdisp;
+	VARIANT *bagvar = &params->rgvarg[params->cArgs - bagArg - 1];
+	CComVariant arg((LPOLESTR)field.c_str()), value;
+	if (!VariantDispGet(bagvar, &bagdisp) || FAILED(DispInvoke(bagdisp, L"GetValue", 1, &arg, &value, DISPATCH_METHOD))) return false;
+
+	if (cond == cond_nan) return std::isnan(Variant2Double(value, NAN));
+	CComVariant str;
+	bool same = SUCCEEDED(VariantChangeType(&str, &value, 0, VT_BSTR)) && str.bstrVal && _wcsicmp(str.bstrVal, text.c_str()) == 0;
+	return (cond == cond_eq) ? same : !same;
+}
+
+void StopRules::Process(DISPID dispid, const DISPPARAMS *params) {
+	if (dispid != dispid_) return;
+
+	uv_mutex_lock(&mutex_);
+	rules_t rules = rules_;
+	uv_mutex_unlock(&mutex_);
+	if (!rules || rules->empty()) return;
+
+	// the bag is read without the lock, a server may raise events from several threads
+	std::vector<char> resets(rules->size()), hits(rules->size());
+	for (size_t i = 0; i < rules->size(); i++) {
+		const rule_t &rule = (*rules)[i];
+		resets[i] = !rule.reset.empty() && ArgFilter::MatchAll(rule.reset, params);
+		hits[i] = ArgFilter::MatchAll(rule.when, params) && rule.Test(params);
+	}
+
+	uv_mutex_lock(&mutex_);
+	// rules replaced meanwhile start counting afresh
+	if (rules != rules_) {
+		uv_mutex_unlock(&mutex_);
+		return;
+	}
+	bool fire = false;
+	for (size_t i = 0; i < rules->size(); i++) {
+		if (resets[i]) counts_[i] = 0;
+		if (!hits[i] || ++counts_[i] < (*rules)[i].limit) continue;
+		counts_[i] = 0;
+		if (!fire) firedRule_ = (int)i;
+		fire = true;
+	}
+
+	// the server is inside its event call, so the stop request is made from another thread
+	if (fire && target_) {
+		fired_++;
+		IDispatch *target = target_;
+		target->AddRef();
+		auto call = new std::pair<IDispatch*, DISPID>(target, method_);
+		if (!QueueUserWorkItem(StopWorker, call, WT_EXECUTEDEFAULT)) {
+			target->Release();
+			delete call;
+		}
+	}
+	uv_mutex_unlock(&mutex_);
+}
+
+DWORD WINAPI StopRules::StopWorker(LPVOID param) {
+	auto call = (std::pair<IDispatch*, DISPID>*)param;
+	HRESULT hrinit = CoInitializeEx(0, COINIT_MULTITHREADED);
+	DispInvoke(call->first, call->second);
+	call->first->Release();
+	if SUCCEEDED(hrinit) CoUninitialize();
+	delete call;
+	return 0;
+}
+
+Local<Object> StopRules::ToObject(Isolate *isolate) {
+	Local<Object> obj = Object::New(isolate);
+	uv_mutex_lock(&mutex_);
+	obj->Set(String::NewFromUtf8(isolate, "armed"), Boolean::New(isolate, rules_ && !rules_->empty()));
+	obj->Set(String::NewFromUtf8(isolate, "fired"), Number::New(isolate, fired_));
+	if (firedRule_ >= 0) obj->Set(String::NewFromUtf8(isolate, "rule"), Number::New(isolate, firedRule_));
+	uv_mutex_unlock(&mutex_);
+	return obj;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+bool ArgFilter::Match(const DISPPARAMS *params) const {
+	if (arg >= params->cArgs) return false;
+	double val = Variant2Double(params->rgvarg[params->cArgs - arg - 1], NAN);
+	switch (op) {
+	case op_eq: return val == value;
+	case op_ne: return val != value;
+	case op_lt: return val < value;
+	case op_le: return val <= value;
+	case op_gt: return val > value;
+	case op_ge: return val >= value;
+	case op_in: return std::find(values.begin(), values.end(), val) != values.end();
+	}
+	return false;
+}
+
+bool ArgFilter::MatchAll(const std::vector<ArgFilter> &filters, const DISPPARAMS *params) {
+	for (auto &filter : filters) {
+		if (!filter.Match(params)) return false;
+	}
+	return true;
+}
+
+bool ArgFilter::Parse(const Local<Value> &spec, std::vector<ArgFilter> &filters) {
+	static const struct { const char *name; op_t op; } ops[] = {
+		{ "eq", op_eq }, { "ne", op_ne }, { "lt", op_lt }, { "le", op_le }, { "gt", op_gt }, { "ge", op_ge }, { "in", op_in }
+	};
+	if (!spec->IsArray()) {
+		if (!spec->IsObject()) return false;
+		auto items = Nan::New<Array>(1);
+		Nan::Set(items, 0, spec);
+		return Parse(items, filters);
+	}
+	auto items = Local<Array>::Cast(spec);
+	for (uint32_t i = 0; i < items->Length(); i++) {
+		auto item = Nan::Get(items, i).ToLocalChecked();
+		if (!item->IsObject()) return false;
+		auto obj = item->ToObject();
+		auto arg = Nan::Get(obj, New("arg").ToLocalChecked()).ToLocalChecked();
+		if (!arg->IsUint32()) return false;
+		bool matched = false;
+		for (auto &op : ops) {
+			auto key = New(op.name).ToLocalChecked();
+			if (!Nan::Has(obj, key).FromJust()) continue;
+			matched = true;
+			auto val = Nan::Get(obj, key).ToLocalChecked();
+			ArgFilter filter;
+			filter.arg = arg->Uint32Value();
+			filter.op = op.op;
+			filter.value = 0;
+			if (op.op == op_in) {
+				if (!val->IsArray()) return false;
+				auto vals = Local<Array>::Cast(val);
+				for (uint32_t j = 0; j < vals->Length(); j++) {
+					filter.values.push_back(Nan::Get(vals, j).ToLocalChecked()->NumberValue());
+				}
+			}
+			else {
+				filter.value = val->NumberValue();
+			}
+			filters.push_back(filter);
+		}
+		if (!matched) return false;
+	}
+	return !filters.empty();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 void ThreadedCallbackInvokation::WaitForExecution() {
   	uv_cond_wait(&m_cond, &m_mutex);
@@ -271,3 +952,141 @@ void ThreadedCallbackInvokation::SignalDoneExecuting() {
   uv_cond_signal(&m_cond);
   uv_mutex_unlock(&m_mutex);
 }
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+thread_local std::map<uint32_t, EventWaiter*> EventWaiter::g_waiters;
+thread_local uint32_t EventWaiter::g_next_id = 1;
+
+EventWaiter::EventWaiter(Isolate *isolate)
+: id_(g_next_id++)
+, settled_(false)
+, handles_(0)
+, resolver_(isolate, Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked())
+, cookie_(0) {
+	g_waiters[id_] = this;
+}
+
+EventWaiter::~EventWaiter() {
+	g_waiters.erase(id_);
+	resolver_.Reset();
+	error_.Reset();
+	value_.Reset();
+}
+
+Local<Promise> EventWaiter::GetPromise(Isolate *isolate) {
+	return resolver_.Get(isolate)->GetPromise();
+}
+
+Local<Function> EventWaiter::NewFireFunction(Isolate *isolate) {
+	return FunctionTemplate::New(isolate, NodeFire, Integer::NewFromUnsigned(isolate, id_))->GetFunction();
+}
+
+Local<Function> EventWaiter::NewCancelFunction(Isolate *isolate) {
+	return FunctionTemplate::New(isolate, NodeCancel, Integer::NewFromUnsigned(isolate, id_))->GetFunction();
+}
+
+void EventWaiter::Start(IConnectionPoint *point, DWORD cookie, uint32_t timeout) {
+	point_ = point;
+	cookie_ = cookie;
+
+	// the async handle keeps the loop alive while waiting and defers unadvise out of the event call
+	uv_loop_t *loop = CallbackQueue::LoopOf(Isolate::GetCurrent());
+	uv_async_init(loop, &async_, OnAsync);
+	uv_timer_init(loop, &timer_);
+	async_.data = this;
+	timer_.data = this;
+	handles_ = 2;
+	if (timeout > 0) uv_timer_start(&timer_, OnTimeout, timeout, 0);
+}
+
+void EventWaiter::Settle(Isolate *isolate, const Local<Value> &error, const Local<Value> &value) {
+	if (settled_) return;
+	settled_ = true;
+	if (!error.IsEmpty()) error_.Reset(isolate, error);
+	if (!value.IsEmpty()) value_.Reset(isolate, value);
+	uv_timer_stop(&timer_);
+	uv_async_send(&async_);
+}
+
+void EventWaiter::Finish() {
+	if (point_) {
+		point_->Unadvise(cookie_);
+		point_.Release();
+	}
+
+	Nan::HandleScope scope;
+	auto isolate = Isolate::GetCurrent();
+
+	// settle inside a callback scope, so continuations run right away
+	Local<Value> argv[] = {
+		error_.IsEmpty() ? Undefined(isolate) : error_.Get(isolate),
+		value_.IsEmpty() ? Undefined(isolate) : value_.Get(isolate)
+	};
+	Local<Function> settle = FunctionTemplate::New(isolate, NodeSettle, resolver_.Get(isolate))->GetFunction();
+	Nan::AsyncResource resource("qia:EventWaiter");
+	resource.runInAsyncScope(Nan::New<Object>(), settle, 2, argv);
+
+	uv_close((uv_handle_t*)&async_, OnClose);
+	uv_close((uv_handle_t*)&timer_, OnClose);
+}
+
+void EventWaiter::Cleanup() {
+	std::map<uint32_t, EventWaiter*> waiters(g_waiters);
+	for (auto &it : waiters) {
+		EventWaiter *self = it.second;
+		self->settled_ = true;
+		if (self->point_) {
+			self->point_->Unadvise(self->cookie_);
+			self->point_.Release();
+		}
+		self->resolver_.Reset();
+		self->error_.Reset();
+		self->value_.Reset();
+		// a settled waiter is already closing its handles in Finish
+		if (self->handles_ > 0 && !uv_is_closing((uv_handle_t*)&self->async_)) {
+			uv_close((uv_handle_t*)&self->async_, OnClose);
+			uv_close((uv_handle_t*)&self->timer_, OnClose);
+		}
+	}
+}
+
+void EventWaiter::NodeFire(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	auto it = g_waiters.find(args.Data()->Uint32Value());
+	if (it == g_waiters.end()) return;
+	int argcnt = args.Length();
+	Local<Array> items = Array::New(isolate, argcnt);
+	for (int i = 0; i < argcnt; i++) items->Set((uint32_t)i, args[i]);
+	it->second->Settle(isolate, Local<Value>(), items);
+}
+
+void EventWaiter::NodeCancel(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	auto it = g_waiters.find(args.Data()->Uint32Value());
+	if (it == g_waiters.end()) return;
+	it->second->Settle(isolate, Error(isolate, "cancelled"), Local<Value>());
+}
+
+void EventWaiter::NodeSettle(const FunctionCallbackInfo<Value> &args) {
+	Local<Context> context = args.GetIsolate()->GetCurrentContext();
+	Local<Promise::Resolver> resolver = Local<Promise::Resolver>::Cast(args.Data());
+	if (!args[0]->IsUndefined()) resolver->Reject(context, args[0]);
+	else resolver->Resolve(context, args[1]);
+}
+
+void EventWaiter::OnAsync(uv_async_t *handle) {
+	((EventWaiter*)handle->data)->Finish();
+}
+
+void EventWaiter::OnTimeout(uv_timer_t *handle) {
+	Nan::HandleScope scope;
+	auto isolate = Isolate::GetCurrent();
+	((EventWaiter*)handle->data)->Settle(isolate, Error(isolate, "timeout"), Local<Value>());
+}
+
+void EventWaiter::OnClose(uv_handle_t *handle) {
+	EventWaiter *self = (EventWaiter*)handle->data;
+	if (--self->handles_ == 0) delete self;
+}
+
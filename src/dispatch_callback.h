@@ -3,21 +3,174 @@
 #include "utils.h"
 #include <string>
 #include <map>
+#include <algorithm>
+#include <cmath>
 
 
 class DispatchCallback;
 
 struct CalllbackInfo {
 	DispatchCallback* caller;
-	std::wstring name;
+	DISPID dispid;
 	HRESULT hrcode;
 	DISPPARAMS *pDispParams;
 	VARIANT *pVarResult;
 	LONG refernce;
+	int bagArg;
+	PropertyBag bag;
+	uint64_t arrived, dispatched; // uv_hrtime() on arrival in Invoke and at dispatchToV8
+};
+
+// Log-linear histogram of queue latencies in microseconds, 8 sub-buckets per power of two
+// Updated and read on the event loop thread only
+class LatencyHistogram {
+public:
+	enum { sub_buckets = 8, linear_buckets = 16, buckets = linear_buckets + sub_buckets * 40 };
+	inline LatencyHistogram() { Reset(); }
+	void Reset();
+	void Add(uint64_t us);
+	uint64_t Percentile(double p) const;
+	Local<Object> ToObject(Isolate *isolate) const;
+
+	uint64_t count, sum, max;
+
+private:
+	static int BucketOf(uint64_t us);
+	static uint64_t BucketLimit(int index);
+	uint32_t counts[buckets];
+};
+
+// Argument predicate evaluated on the calling thread, e.g. { arg: 2, ge: 3 } or { arg: 0, in: [3, 4] }
+struct ArgFilter {
+	enum op_t { op_eq, op_ne, op_lt, op_le, op_gt, op_ge, op_in };
+	UINT arg;
+	op_t op;
+	double value;
+	std::vector<double> values;
+
+	bool Match(const DISPPARAMS *params) const;
+	static bool MatchAll(const std::vector<ArgFilter> &filters, const DISPPARAMS *params);
+	static bool Parse(const Local<Value> &spec, std::vector<ArgFilter> &filters);
+};
+
+// Name -> value map kept current from a sink event on the calling thread, e.g. { key: 0, value: 1 }
+// Reads on the event loop thread are in-process lookups, the version counts event updates
+class VariantMirror {
+public:
+	VariantMirror(UINT key_arg, UINT value_arg);
+	~VariantMirror();
+
+	void Update(const DISPPARAMS *params);
+	bool Seed(const std::wstring &key, const VARIANT &value);
+	void Remove(const std::wstring &key);
+	bool Get(const std::wstring &key, VARIANT *value);
+	Local<Object> ToObject(Isolate *isolate);
+	inline LONG Version() const { return version_; }
+
+private:
+	UINT key_arg_, value_arg_;
+	uv_mutex_t mutex_;
+	std::map<std::wstring, CComVariant> values_;
+	volatile LONG version_;
+};
+
+// Fixed-memory (time, value) rings per key fed from a sink event on the calling thread,
+// e.g. { key: 1, value: 3, capacity: 4096 }; times are milliseconds on the process.hrtime() clock
+class SeriesBuffer {
+public:
+	SeriesBuffer(UINT key_arg, UINT value_arg, size_t capacity);
+	~SeriesBuffer();
+
+	void Update(const DISPPARAMS *params, uint64_t arrived);
+	void Clear(const std::wstring *key);
+	Local<Array> Keys(Isolate *isolate);
+	// samples in [from, to], min-max decimated to at most 2 * buckets points when buckets > 0
+	Local<Object> Query(Isolate *isolate, const std::wstring &key, double from, double to, size_t buckets);
+
+private:
+	struct ring_t {
+		std::vector<double> times, values;
+		size_t head, count;
+		inline size_t index(size_t i) const { return (head + times.size() - count + i) % times.size(); }
+	};
+
+	UINT key_arg_, value_arg_;
+	size_t capacity_;
+	uv_mutex_t mutex_;
+	std::map<std::wstring, ring_t> rings_;
+};
+
+// Conditions on one sink event that stop a run from the calling thread, without a round trip through JS, e.g.
+// { when: [filter], reset: [filter], bag: argIndex, field: 'TestResult', eq: 'Failed', count: 3 } or { ..., nan: true }
+class StopRules {
+public:
+	StopRules();
+	~StopRules();
+
+	// replaces the rules, an empty array disarms them
+	bool Set(DISPID dispid, IDispatch *target, DISPID method, const Local<Value> &rules);
+	void Process(DISPID dispid, const DISPPARAMS *params);
+	inline bool Handles(DISPID dispid) const { return dispid == dispid_; }
+	Local<Object> ToObject(Isolate *isolate);
+
+private:
+	struct rule_t {
+		enum cond_t { cond_any, cond_eq, cond_ne, cond_nan };
+		std::vector<ArgFilter> when, reset;
+		int bagArg;
+		std::wstring field, text;
+		cond_t cond;
+		LONG limit;
+		// may read the bag, so it is called without holding mutex_
+		bool Test(const DISPPARAMS *params) const;
+	};
+	typedef std::shared_ptr<const std::vector<rule_t>> rules_t;
+	static DWORD WINAPI StopWorker(LPVOID param);
+
+	volatile LONG dispid_;
+	uv_mutex_t mutex_;
+	rules_t rules_;  // replaced as a whole by Set, events test a snapshot outside the lock
+	std::vector<LONG> counts_;
+	CComPtr<IDispatch> target_;
+	DISPID method_;
+	LONG fired_;
+	int firedRule_;
 };
 
 class ThreadedCallbackInvokation;
 
+// Events of sinks advised on one event loop, delivered to JS on that loop's thread
+// The main thread and every worker_thread get their own queue when they advise their first sink
+class CallbackQueue {
+public:
+	static uv_loop_t *LoopOf(Isolate *isolate);
+	static CallbackQueue *Get(Isolate *isolate);
+	static CallbackQueue *Find(Isolate *isolate);
+	// the loop is going away: release waiting COM threads and refuse further events
+	static void Shutdown(Isolate *isolate);
+
+	inline bool inLoopThread() const { return threadID_ == GetCurrentThreadId(); }
+	// called from other threads, returns once the handler has run on the loop thread
+	void Call(CalllbackInfo *cbinfo);
+
+	uint64_t arrived; // arrival of the event being handled on this loop
+
+private:
+	CallbackQueue(uv_loop_t *loop);
+	static void OnAsync(uv_async_t *handle);
+
+	static uv_once_t g_once;
+	static uv_mutex_t g_mutex;
+	static std::map<uv_loop_t*, CallbackQueue*> g_queues;
+
+	uv_loop_t *loop_;
+	DWORD threadID_;
+	bool closed_;
+	uv_mutex_t mutex_;
+	std::queue<ThreadedCallbackInvokation *> queue_;
+	uv_async_t async_;
+};
+
 class DispatchCallback : public UnknownImpl<IDispatch> {
 public:
     DispatchCallback(const Local<Object> &_obj, CLSID clsid, ITypeInfo* TypeInfo);
@@ -34,30 +187,50 @@ public:
 	virtual HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId);
     virtual HRESULT STDMETHODCALLTYPE Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr);
 
-	static bool inMainThread();
+	void bindCallbacks(const Local<Object> &obj);
+	// the connection this sink is advised on, unadvised by Cleanup if still standing
+	void Advised(IConnectionPoint *point, DWORD cookie);
+	inline Local<Object> sinkObject() { return obj_.Get(Isolate::GetCurrent()); }
+	inline LatencyHistogram &latency() { return latency_; }
+	inline VariantMirror *mirror() { return mirror_.get(); }
+	inline SeriesBuffer *series() { return series_.get(); }
+	inline StopRules &stopRules() { return stopRules_; }
 	static void dispatchToV8(CalllbackInfo *self, bool dispatched);
-	static void WatcherCallback(uv_async_t *w, int revents);
+	static NAN_METHOD(NodeEventArrival);
 
 public:
 	static NAN_MODULE_INIT(Initialize);
-
-private:
-	static DWORD g_threadID;
-	static uv_mutex_t    g_queue_mutex;
-    static std::queue<ThreadedCallbackInvokation *> g_queue;
-    static uv_async_t         g_async;
+	// the isolate is going away: unadvise its sinks and drop their handles
+	static void Cleanup(Isolate *isolate);
 
 private:
 
     HRESULT loadMyTypeInfo();
-	std::wstring getNameOfDispId(DISPID);
+	template<typename T>
+	HRESULT loadMethodSpecs(const Local<Object> &self, const char *key, T process);
+	bool isCallbackDispId(DISPID);
+	bool isNativeDispId(DISPID);
 
 	HRESULT hrInit_;
+	Isolate *isolate_;
+	CallbackQueue *queue_;
+	CComPtr<IConnectionPoint> point_;
+	DWORD cookie_;
 	Persistent<Object> obj_;
+	typedef Persistent<Function, CopyablePersistentTraits<Function>> function_t;
+	std::map<DISPID, function_t> functions_;
 	ITypeInfo* TypeInfo_;
 	CLSID clsid_;
 	CLSID clsidTypelib_;
     std::map<DISPID, std::wstring> callbackNames_;
+	std::map<DISPID, int> bagArgs_;
+	std::map<DISPID, std::vector<ArgFilter>> filters_;
+	LatencyHistogram latency_;
+	std::unique_ptr<VariantMirror> mirror_;
+	DISPID mirrorDispId_;
+	std::unique_ptr<SeriesBuffer> series_;
+	DISPID seriesDispId_;
+	StopRules stopRules_;
 	LONG* pRefernce_;
 };
 
@@ -75,3 +248,42 @@ private:
     uv_cond_t m_cond;
     uv_mutex_t m_mutex;
 };
+
+// One-shot wait for a single sink event
+// The sink function settles a promise, the deadline is a uv timer, so waiting costs no CPU
+class EventWaiter {
+public:
+	EventWaiter(Isolate *isolate);
+	~EventWaiter();
+
+	Local<Promise> GetPromise(Isolate *isolate);
+	Local<Function> NewFireFunction(Isolate *isolate);
+	Local<Function> NewCancelFunction(Isolate *isolate);
+	void Start(IConnectionPoint *point, DWORD cookie, uint32_t timeout);
+	void Settle(Isolate *isolate, const Local<Value> &error, const Local<Value> &value);
+	// unadvise and close every waiter of the calling thread, its isolate is going away
+	static void Cleanup();
+
+private:
+	static void NodeFire(const FunctionCallbackInfo<Value> &args);
+	static void NodeCancel(const FunctionCallbackInfo<Value> &args);
+	static void NodeSettle(const FunctionCallbackInfo<Value> &args);
+	static void OnAsync(uv_async_t *handle);
+	static void OnTimeout(uv_timer_t *handle);
+	static void OnClose(uv_handle_t *handle);
+	void Finish();
+
+	static thread_local std::map<uint32_t, EventWaiter*> g_waiters;
+	static thread_local uint32_t g_next_id;
+
+	uint32_t id_;
+	bool settled_;
+	int handles_;
+	Persistent<Promise::Resolver> resolver_;
+	Persistent<Value> error_, value_;
+	CComPtr<IConnectionPoint> point_;
+	DWORD cookie_;
+	uv_async_t async_;
+	uv_timer_t timer_;
+};
+
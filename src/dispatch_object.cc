@@ -8,8 +8,9 @@ using Nan::New;
 using Nan::AsyncQueueWorker;
 using Nan::AsyncWorker;
 
-Persistent<ObjectTemplate> DispObject::inst_template;
-Persistent<FunctionTemplate> DispObject::clazz_template;
+thread_local Persistent<ObjectTemplate> DispObject::inst_template;
+thread_local Persistent<FunctionTemplate> DispObject::clazz_template;
+thread_local std::set<DispObject*> DispObject::instances;
 
 bool DispObject::is64arch = false;
 
@@ -17,18 +18,18 @@ bool DispObject::is64arch = false;
 DispObject::DispObject(const DispInfoPtr &ptr, const std::wstring &nm, DISPID id, LONG indx, int opt, const std::wstring& inprocServer32)
 	: disp(ptr), options((ptr->options & option_mask) | opt), name(nm), dispid(id), index(indx)
 	, inprocServer32_(inprocServer32)
-	, pTypelib_(nullptr)
 {	
 	if (dispid == DISPID_UNKNOWN) {
 		dispid = DISPID_VALUE;
         options |= option_prepared;
 	}
 	else options |= option_owned;
+	instances.insert(this);
 	NODE_DEBUG_FMT("DispObject '%S' constructor", name.c_str());
 }
 
 DispObject::~DispObject() {
-	if (pTypelib_) pTypelib_->Release();
+	instances.erase(this);
 	NODE_DEBUG_FMT("DispObject '%S' destructor", name.c_str());
 }
 
@@ -121,12 +122,12 @@ bool DispObject::get(LPOLESTR tag, LONG index, const PropertyCallbackInfo<Value>
 		}
 		CComPtr<IDispatch> ptr;
 		if (VariantDispGet(&value, &ptr)) {
-			DispInfoPtr disp_result(new DispInfo(ptr, tag, options, &disp));
+			DispInfoPtr disp_result = std::make_shared<DispInfo>(ptr, tag, options, &disp);
 			Local<Object> result = DispObject::NodeCreate(isolate, args.This(), disp_result, tag, DISPID_UNKNOWN, -1, opt);
 			args.GetReturnValue().Set(result);
 		}
 		else {
-			args.GetReturnValue().Set(Variant2Value(isolate, value));
+			args.GetReturnValue().Set(Variant2ValueOwned(isolate, value));
 		}
 	}
 
@@ -182,12 +183,12 @@ bool DispObject::set(LPOLESTR tag, LONG index, const Local<Value> &value, const
 		rtag.reserve(32);
 		rtag += L"@";
 		rtag += tag;
-		DispInfoPtr disp_result(new DispInfo(ptr, tag, options, &disp));
+		DispInfoPtr disp_result = std::make_shared<DispInfo>(ptr, tag, options, &disp);
 		Local<Object> result = DispObject::NodeCreate(isolate, args.This(), disp_result, rtag);
 		args.GetReturnValue().Set(result);
 	}
 	else {
-		args.GetReturnValue().Set(Variant2Value(isolate, ret));
+		args.GetReturnValue().Set(Variant2ValueOwned(isolate, ret));
 	}
     return true;
 }
@@ -217,6 +218,33 @@ HRESULT DispObject::valueOf(Isolate *isolate, VARIANT &value) {
 	return hrcode;
 }
 
+// Value marshalled when the wrapper is passed to a COM method or to ole functions
+// A wrapper holding an IDispatch goes as VT_DISPATCH without any Invoke, a member wrapper is read once
+// and keeps the object it resolves to, unless lazyArguments asks for a fresh read on every pass
+HRESULT DispObject::argumentOf(Isolate *isolate, VARIANT &value) {
+	if (!disp) return E_UNEXPECTED;
+	// a member wrapper of DISPID_VALUE is not the object itself until prepared
+	if (is_prepared() && is_object() && index < 0) {
+		value.vt = VT_DISPATCH;
+		value.pdispVal = (IDispatch*)disp->ptr;
+		if (value.pdispVal) value.pdispVal->AddRef();
+		return S_OK;
+	}
+
+	// methods without arguments are evaluated on every pass, there is no object to keep
+	if ((options & option_function_simple) != 0) return disp->ExecuteMethod(dispid, 0, 0, &value);
+
+	HRESULT hrcode = disp->GetProperty(dispid, index, &value);
+	if (FAILED(hrcode) || ConvertOptions::Current().lazyArguments || index >= 0) return hrcode;
+	CComPtr<IDispatch> ptr;
+	if (VariantDispGet(&value, &ptr)) {
+		disp = std::make_shared<DispInfo>(ptr, name, options, &disp);
+		dispid = DISPID_VALUE;
+		options |= option_prepared;
+	}
+	return hrcode;
+}
+
 HRESULT DispObject::valueOf(Isolate *isolate, const Local<Object> &self, Local<Value> &value) {
 	if (!is_prepared()) prepare();
 	HRESULT hrcode;
@@ -236,7 +264,7 @@ HRESULT DispObject::valueOf(Isolate *isolate, const Local<Object> &self, Local<V
 
 		// convert result to v8 value
 		if SUCCEEDED(hrcode) {
-			value = Variant2Value(isolate, val);
+			value = Variant2ValueOwned(isolate, val);
 		}
 
 		// or return self as object
@@ -329,6 +357,16 @@ void DispObject::NodeInit(const Local<Object> &target) {
     target->Set(String::NewFromUtf8(isolate, "Object"), clazz->GetFunction());
 	target->Set(String::NewFromUtf8(isolate, "cast"), FunctionTemplate::New(isolate, NodeCast, target)->GetFunction());
 	target->Set(String::NewFromUtf8(isolate, "release"), FunctionTemplate::New(isolate, NodeRelease, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "bag"), FunctionTemplate::New(isolate, NodeBag, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "options"), FunctionTemplate::New(isolate, NodeOptions, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "stringStats"), FunctionTemplate::New(isolate, NodeStringStats, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "callStats"), FunctionTemplate::New(isolate, NodeCallStats, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "share"), FunctionTemplate::New(isolate, NodeShare, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "unshare"), FunctionTemplate::New(isolate, NodeUnshare, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "fromShared"), FunctionTemplate::New(isolate, NodeFromShared, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "snapshot"), FunctionTemplate::New(isolate, NodeSnapshot, target)->GetFunction());
+	target->Set(String::NewFromUtf8(isolate, "enumerate"), FunctionTemplate::New(isolate, NodeEnumerate, target)->GetFunction());
+	Nan::SetMethod(target, "fetchBatch", NodeFetchBatch);
 
     //Context::GetCurrent()->Global()->Set(String::NewFromUtf8("ActiveXObject"), t->GetFunction());
 	NODE_DEBUG_MSG("DispObject initialized");
@@ -510,12 +548,39 @@ void DispObject::NodeGet(Local<String> name, const PropertyCallbackInfo<Value>&
 	else if (_wcsicmp(id, L"toString") == 0) {
 		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeToString, args.This())->GetFunction());
 	}
+	else if (_wcsicmp(id, L"invokeOut") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(NodeInvokeOut, args.This())->GetFunction());
+	}
 	else if (_wcsicmp(id, L"callbackAdvise") == 0) {
 		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionAdvise, args.This())->GetFunction());
 	}
 	else if (_wcsicmp(id, L"callbackUnadvise") == 0) {
 		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionUnadvise, args.This())->GetFunction());
 	}
+	else if (_wcsicmp(id, L"callbackAdviseOnce") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionAdviseOnce, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackStats") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionStats, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackMirror") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionMirror, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackMirrorVersion") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionMirrorVersion, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackSeries") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionSeries, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackSeriesClear") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionSeriesClear, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackStopRules") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionStopRules, args.This())->GetFunction());
+	}
+	else if (_wcsicmp(id, L"callbackRebind") == 0) {
+		args.GetReturnValue().Set(Nan::New<FunctionTemplate>(ConnectionRebind, args.This())->GetFunction());
+	}
 	else if (_wcsicmp(id, L"__inprocServer32") == 0) {
 		args.GetReturnValue().Set(String::NewFromTwoByte(isolate, (uint16_t*)self->inprocServer32_.c_str()));
 	}
@@ -616,6 +681,283 @@ void DispObject::NodeCast(const FunctionCallbackInfo<Value>& args) {
 	args.GetReturnValue().Set(inst);
 }
 
+void DispObject::NodeBag(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	CComVariant var;
+	CComPtr<IDispatch> ptr;
+	if (args.Length() < 1 || !args[0]->IsObject() || !GetValueOf(isolate, args[0]->ToObject(), var) || !VariantDispGet(&var, &ptr)) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	PropertyBag bag;
+	HRESULT hrcode = bag.Read(ptr);
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"PropertyBag"));
+		return;
+	}
+	args.GetReturnValue().Set(bag.ToObject(isolate));
+}
+
+// ole.options([options]) -> conversion options of this isolate, updated from the argument
+void DispObject::NodeOptions(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	ConvertOptions &opts = ConvertOptions::Current();
+	if (args.Length() > 0) opts.Read(args[0]);
+	args.GetReturnValue().Set(opts.ToObject(isolate));
+}
+
+// ole.stringStats([reset]) -> { hits, misses, hitRate, size, capacity } of the string intern table
+void DispObject::NodeStringStats(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	StringCache &cache = StringCache::Current();
+	args.GetReturnValue().Set(cache.Stats(isolate));
+	if (args.Length() > 0 && v8val2bool(args[0], false)) cache.ResetStats();
+}
+
+// ole.callStats([reset]) -> { calls, vectorsCreated, stringsAllocated, stringsReused, arenaAllocationsPerCall } of this thread's call arena
+// calls are the Invokes made on this thread
+void DispObject::NodeCallStats(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	args.GetReturnValue().Set(CallArena::Stats(isolate));
+	if (args.Length() > 0 && v8val2bool(args[0], false)) CallArena::ResetStats();
+}
+
+// Objects shared between threads through the Global Interface Table
+// A token is the GIT cookie, each thread materializes it once and reuses its proxy
+namespace {
+	uv_once_t git_once = UV_ONCE_INIT;
+	uv_mutex_t git_mutex;
+	IGlobalInterfaceTable *git = nullptr;
+	std::map<DWORD, std::wstring> git_names;
+	thread_local std::map<DWORD, CComPtr<IDispatch>> git_proxies;
+
+	void InitGlobalInterfaceTable() {
+		uv_mutex_init(&git_mutex);
+		CoCreateInstance(CLSID_StdGlobalInterfaceTable, NULL, CLSCTX_INPROC_SERVER, IID_IGlobalInterfaceTable, (void**)&git);
+	}
+
+	// every entry point goes through here, git_mutex only exists once initialized
+	IGlobalInterfaceTable *GlobalInterfaceTable() {
+		uv_once(&git_once, InitGlobalInterfaceTable);
+		return git;
+	}
+
+	bool SharedName(DWORD token, std::wstring *name) {
+		GlobalInterfaceTable();
+		uv_mutex_lock(&git_mutex);
+		auto it = git_names.find(token);
+		bool found = it != git_names.end();
+		if (found && name) *name = it->second;
+		uv_mutex_unlock(&git_mutex);
+		return found;
+	}
+}
+
+// Property layouts of snapshot(), one per interface and name selection
+// Every snapshot of a layout comes from the same ObjectTemplate and so shares its hidden class
+namespace {
+	struct snapshot_layout_t {
+		std::vector<DISPID> dispids;
+		std::vector<std::wstring> names;
+		Persistent<ObjectTemplate, CopyablePersistentTraits<ObjectTemplate>> templ;
+	};
+	thread_local std::map<std::wstring, snapshot_layout_t> snapshot_layouts;
+
+	std::wstring InterfaceKey(IDispatch *disp) {
+		CComPtr<ITypeInfo> info;
+		TYPEATTR *attr;
+		if (disp->GetTypeInfo(0, 0, &info) != S_OK || !info || FAILED(info->GetTypeAttr(&attr))) return std::wstring();
+		wchar_t guid[64];
+		int len = StringFromGUID2(attr->guid, guid, 64);
+		info->ReleaseTypeAttr(attr);
+		return len > 0 ? std::wstring(guid) : std::wstring();
+	}
+}
+
+void DispObject::NodeCleanup() {
+	// wrappers the GC has not collected yet give up their interfaces before COM is uninitialized
+	for (DispObject *self : instances) {
+		self->connections_.clear();
+		self->disp.reset();
+	}
+	inst_template.Reset();
+	clazz_template.Reset();
+	git_proxies.clear();
+	snapshot_layouts.clear();
+	StringCache::Current().Clear();
+	ClearRecordLayouts();
+}
+
+// ole.share(obj) -> token usable from any thread or worker
+void DispObject::NodeShare(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	CComVariant var;
+	CComPtr<IDispatch> ptr;
+	if (args.Length() < 1 || !args[0]->IsObject() || !GetValueOf(isolate, args[0]->ToObject(), var) || !VariantDispGet(&var, &ptr)) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	IGlobalInterfaceTable *git = GlobalInterfaceTable();
+	if (!git) {
+		isolate->ThrowException(Win32Error(isolate, REGDB_E_CLASSNOTREG, L"GlobalInterfaceTable"));
+		return;
+	}
+	DWORD token;
+	HRESULT hrcode = git->RegisterInterfaceInGlobal(ptr, IID_IDispatch, &token);
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"RegisterInterfaceInGlobal"));
+		return;
+	}
+	DispObject *self = DispObject::Unwrap<DispObject>(args[0]->ToObject());
+	uv_mutex_lock(&git_mutex);
+	git_names[token] = self ? self->name : L"Shared";
+	uv_mutex_unlock(&git_mutex);
+	git_proxies[token].Attach(ptr);
+	args.GetReturnValue().Set((uint32_t)token);
+}
+
+// ole.unshare(token) -> revoke the token, objects already materialized stay valid
+void DispObject::NodeUnshare(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	if (args.Length() < 1 || !args[0]->IsUint32()) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	IGlobalInterfaceTable *git = GlobalInterfaceTable();
+	if (!git) {
+		isolate->ThrowException(Win32Error(isolate, REGDB_E_CLASSNOTREG, L"GlobalInterfaceTable"));
+		return;
+	}
+	DWORD token = args[0]->Uint32Value();
+	uv_mutex_lock(&git_mutex);
+	bool found = git_names.erase(token) > 0;
+	uv_mutex_unlock(&git_mutex);
+	git_proxies.erase(token);
+	if (found) git->RevokeInterfaceFromGlobal(token);
+	args.GetReturnValue().Set(found);
+}
+
+// ole.fromShared(token) -> Dispatch object for the calling thread
+void DispObject::NodeFromShared(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	std::wstring name;
+	if (args.Length() < 1 || !args[0]->IsUint32()) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	IGlobalInterfaceTable *git = GlobalInterfaceTable();
+	if (!git) {
+		isolate->ThrowException(Win32Error(isolate, REGDB_E_CLASSNOTREG, L"GlobalInterfaceTable"));
+		return;
+	}
+	DWORD token = args[0]->Uint32Value();
+	if (!SharedName(token, &name)) {
+		git_proxies.erase(token);
+		isolate->ThrowException(DispError(isolate, E_INVALIDARG, L"fromShared"));
+		return;
+	}
+	CComPtr<IDispatch> &proxy = git_proxies[token];
+	if (!proxy) {
+		HRESULT hrcode = git->GetInterfaceFromGlobal(token, IID_IDispatch, (void**)&proxy);
+		if FAILED(hrcode) {
+			git_proxies.erase(token);
+			isolate->ThrowException(DispError(isolate, hrcode, L"GetInterfaceFromGlobal"));
+			return;
+		}
+	}
+	args.GetReturnValue().Set(NodeCreate(isolate, proxy, name, option_auto));
+}
+
+// ole.snapshot(obj, [names]) -> plain object with every, or the listed, argument-less property read in one call
+void DispObject::NodeSnapshot(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	CComVariant var;
+	CComPtr<IDispatch> ptr;
+	if (args.Length() < 1 || !args[0]->IsObject() || !GetValueOf(isolate, args[0]->ToObject(), var) || !VariantDispGet(&var, &ptr)) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	Local<Array> selected;
+	if (args.Length() > 1 && args[1]->IsArray()) selected = Local<Array>::Cast(args[1]);
+	else if (args.Length() > 1 && !args[1]->IsUndefined()) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+
+	// reuse the type table of the wrapper when it holds this very object
+	DispObject *self = DispObject::Unwrap<DispObject>(args[0]->ToObject());
+	DispInfoPtr disp = (self && self->disp && self->disp->ptr == ptr) ? self->disp : DispInfoPtr(new DispInfo(ptr, self ? self->name : L"Snapshot", option_type));
+	if ((disp->options & option_prepared) == 0) disp->Prepare(ptr);
+
+	std::wstring key = InterfaceKey(ptr);
+	if (key.empty()) {
+		isolate->ThrowException(DispError(isolate, TYPE_E_ELEMENTNOTFOUND, L"snapshot"));
+		return;
+	}
+	std::vector<std::wstring> names;
+	if (!selected.IsEmpty()) {
+		uint32_t cnt = selected->Length();
+		names.resize(cnt);
+		for (uint32_t i = 0; i < cnt; i++) {
+			String::Value name(selected->Get(i));
+			names[i].assign((wchar_t*)*name, name.length());
+			key += L"|";
+			key += names[i];
+		}
+	}
+
+	auto it = snapshot_layouts.find(key);
+	if (it == snapshot_layouts.end()) {
+		snapshot_layout_t layout;
+		if (selected.IsEmpty()) {
+			disp->Enumerate([&disp, &layout](ITypeInfo *info, FUNCDESC *desc) {
+				DispInfo::type_ptr type;
+				if ((desc->invkind & INVOKE_PROPERTYGET) == 0 || !disp->GetTypeInfo(desc->memid, type) || !type->is_property_simple()) return;
+				if (std::find(layout.dispids.begin(), layout.dispids.end(), desc->memid) != layout.dispids.end()) return;
+				CComBSTR name;
+				if (!disp->GetItemName(info, desc->memid, &name)) return;
+				layout.dispids.push_back(desc->memid);
+				layout.names.push_back(std::wstring(name, name.Length()));
+			});
+		}
+		else {
+			for (auto &name : names) {
+				DISPID dispid;
+				HRESULT hrcode = disp->FindProperty((LPOLESTR)name.c_str(), &dispid);
+				if FAILED(hrcode) {
+					isolate->ThrowException(DispError(isolate, hrcode, L"DispPropertyFind", name.c_str()));
+					return;
+				}
+				layout.dispids.push_back(dispid);
+				layout.names.push_back(name);
+			}
+		}
+		Local<ObjectTemplate> templ = ObjectTemplate::New(isolate);
+		for (auto &name : layout.names) {
+			templ->Set(NewCompactString(isolate, name.c_str(), (int)name.length(), NewStringType::kInternalized), Undefined(isolate));
+		}
+		layout.templ.Reset(isolate, templ);
+		it = snapshot_layouts.insert(std::make_pair(key, layout)).first;
+	}
+
+	// properties that fail to read stay undefined
+	snapshot_layout_t &layout = it->second;
+	Local<Object> result = layout.templ.Get(isolate)->NewInstance();
+	for (size_t i = 0; i < layout.dispids.size(); i++) {
+		CComVariant value;
+		if FAILED(disp->GetProperty(layout.dispids[i], -1, &value)) continue;
+		Local<String> name = NewCompactString(isolate, layout.names[i].c_str(), (int)layout.names[i].length(), NewStringType::kInternalized);
+		CComPtr<IDispatch> item;
+		if (VariantDispGet(&value, &item)) {
+			DispInfoPtr disp_result = std::make_shared<DispInfo>(item, layout.names[i], disp->options, &disp);
+			result->Set(name, DispObject::NodeCreate(isolate, args[0]->ToObject(), disp_result, layout.names[i]));
+		}
+		else {
+			result->Set(name, Variant2ValueOwned(isolate, value));
+		}
+	}
+	args.GetReturnValue().Set(result);
+}
 
 class DispObject::DispWorker : public AsyncWorker {
 public:
@@ -653,12 +995,12 @@ public:
             tag.reserve(32);
             tag += L"@";
             tag += self->name;
-            DispInfoPtr disp_result(new DispInfo(ptr, tag, self->options, &self->disp));
+            DispInfoPtr disp_result = std::make_shared<DispInfo>(ptr, tag, self->options, &self->disp);
 			Local<Value> parent = GetFromPersistent("parent");
             result = DispObject::NodeCreate(Isolate::GetCurrent(), parent->ToObject(), disp_result, tag, DISPID_UNKNOWN, -1, 0, self->inprocServer32_);
         }
         else {
-            result = Variant2Value(Isolate::GetCurrent(), ret);
+            result = Variant2ValueOwned(Isolate::GetCurrent(), ret);
         }
 
 		Local<Value> argv[] = {
@@ -704,11 +1046,12 @@ void DispObject::call(Isolate *isolate, const Nan::FunctionCallbackInfo<Value> &
     CComException except;
 	CComVariant ret;
 	LONG argcnt = args.Length();
-	std::vector<CComVariant> vargs(argcnt);
+	VarArguments vargs;
+	vargs.items.resize(argcnt);
 	for (int i = 0; i < argcnt; i ++)
-		Value2Variant(isolate, args[argcnt - i - 1], vargs[i]);
+		Value2Variant(isolate, args[argcnt - i - 1], vargs.items[i]);
 
-	VARIANT *pargs = (argcnt > 0) ? &vargs.front() : 0;
+	VARIANT *pargs = (argcnt > 0) ? &vargs.items.front() : 0;
 	HRESULT hrcode;
 
 	if ((options & option_property) == 0) hrcode = disp->ExecuteMethod(dispid, argcnt, pargs, &ret, &except);
@@ -726,157 +1069,500 @@ void DispObject::call(Isolate *isolate, const Nan::FunctionCallbackInfo<Value> &
         tag.reserve(32);
         tag += L"@";
         tag += name;
-		DispInfoPtr disp_result(new DispInfo(ptr, tag, options, &disp));
+		DispInfoPtr disp_result = std::make_shared<DispInfo>(ptr, tag, options, &disp);
 		result = DispObject::NodeCreate(isolate, args.This(), disp_result, tag);
 	}
 	else {
-		result = Variant2Value(isolate, ret);
+		result = Variant2ValueOwned(isolate, ret);
 	}
     args.GetReturnValue().Set(result);
 }
 
 
-NAN_METHOD(DispObject::ConnectionAdvise) {
+// Method call with out parameters held in native byref storage instead of Variant objects
+// The in arguments come first, then one out argument per entry of outTypes, as they are passed to the method
+class OutInvocation {
+public:
+	bool Prepare(Isolate *isolate, DispInfo *disp, const Local<Value> &member, const Local<Value> &inArgs, const Local<Value> &outTypes) {
+		if (member->IsInt32()) dispid_ = member->Int32Value();
+		else if (member->IsString()) {
+			String::Value vname(member);
+			HRESULT hrcode = disp->FindProperty((LPOLESTR)*vname, &dispid_);
+			if (SUCCEEDED(hrcode) && dispid_ == DISPID_UNKNOWN) hrcode = DISP_E_UNKNOWNNAME;
+			if FAILED(hrcode) {
+				isolate->ThrowException(DispError(isolate, hrcode, L"DispPropertyFind", (LPOLESTR)*vname));
+				return false;
+			}
+		}
+		else return Invalid(isolate);
+		if (!inArgs->IsUndefined() && !inArgs->IsArray()) return Invalid(isolate);
+		if (!outTypes->IsObject()) return Invalid(isolate);
 
-    if (info.Length() < 1 || info[0].IsEmpty() || !info[0]->IsObject()) {
-        ThrowError("callbackAdvise 1'st paramter should be object");
-        return;
-    }
+		// out types from an array, or from the values of an object whose keys name the results
+		Local<Array> types;
+		if (outTypes->IsArray()) types = Local<Array>::Cast(outTypes);
+		else {
+			Local<Object> obj = outTypes->ToObject();
+			Local<Array> keys = obj->GetOwnPropertyNames();
+			types = Array::New(isolate, keys->Length());
+			for (uint32_t i = 0; i < keys->Length(); i++) {
+				String::Value key(keys->Get(i));
+				keys_.emplace_back((wchar_t*)*key, key.length());
+				types->Set(i, obj->Get(keys->Get(i)));
+			}
+		}
 
-	auto self = DispObject::Unwrap<DispObject>(info.This());
-	auto obj = info[0]->ToObject();
-	Local<String> typeClsid;
-	if (Nan::Has(obj, New("__typelib").ToLocalChecked()).FromJust()) {
-		typeClsid = Get(obj, New("__typelib").ToLocalChecked()).ToLocalChecked()->ToString();
+		// storage is sized up front, the byref pointers must stay valid
+		uint32_t incnt = inArgs->IsArray() ? Local<Array>::Cast(inArgs)->Length() : 0;
+		uint32_t outcnt = types->Length();
+		outs_.resize(outcnt);
+		args_.resize(incnt + outcnt);
+		for (uint32_t i = 0; i < outcnt; i++) {
+			VARTYPE vt = VariantObject::ParseType(types->Get(i)) & ~VT_BYREF;
+			CComVariant &out = outs_[i];
+			VARIANT &arg = args_[outcnt - i - 1];
+			if (vt == VT_EMPTY || vt == VT_VARIANT || vt == VT_DECIMAL) {
+				arg.vt = VT_VARIANT | VT_BYREF;
+				arg.pvarVal = &out;
+			}
+			else {
+				out.vt = vt;
+				arg.vt = vt | VT_BYREF;
+				arg.byref = &out.intVal;
+			}
+		}
+		Local<Array> in = incnt > 0 ? Local<Array>::Cast(inArgs) : Local<Array>();
+		for (uint32_t i = 0; i < incnt; i++) {
+			Local<Value> val = in->Get(i);
+			Value2Variant(isolate, val, args_[outcnt + incnt - i - 1]);
+		}
+		return true;
 	}
 
-	// load typelib
-	LPTYPELIB pTypeLib = nullptr;
-
-	if (!typeClsid.IsEmpty()) {
-		CLSID clsid;
-		String::Value vname(typeClsid);
-		auto hr = CLSIDFromString((LPCOLESTR)*vname, &clsid);
+	HRESULT Invoke(DispInfo *disp) {
+		VARIANT *pargs = args_.empty() ? 0 : &args_.front();
+		return disp->ExecuteMethod(dispid_, (LONG)args_.size(), pargs, &ret_, &except_);
+	}
 
-		if (!SUCCEEDED(hr)) {
-			Nan::ThrowError(DispError(Isolate::GetCurrent(), hr, L"GetConnectionTypeInfo", (LPCOLESTR)*vname));
-			return;
+	Local<Value> Result(Isolate *isolate) {
+		if (keys_.empty()) {
+			Local<Array> result = Array::New(isolate, (int)outs_.size());
+			for (uint32_t i = 0; i < outs_.size(); i++) result->Set(i, Variant2ValueOwned(isolate, outs_[i], true));
+			return result;
 		}
-
-		if (FAILED(hr = LoadRegTypeLib(clsid, 1, 0, 0, &pTypeLib))) {
-			Nan::ThrowError(DispError(Isolate::GetCurrent(), hr, L"LoadRegTypeLib", (LPCOLESTR)*vname));
-			return;
+		Local<Object> result = Object::New(isolate);
+		for (size_t i = 0; i < outs_.size(); i++) {
+			result->Set(Bstr2String(isolate, keys_[i].c_str(), (int)keys_[i].length()), Variant2ValueOwned(isolate, outs_[i], true));
 		}
+		return result;
 	}
 
-	if (!pTypeLib) {
-		if (self->pTypelib_) {
-			self->pTypelib_->AddRef();
-			pTypeLib = self->pTypelib_;
-		} else {
-			if (!self->inprocServer32_.empty()) {
-				auto code = LoadTypeLibEx(self->inprocServer32_.c_str(),
-					REGKIND_NONE,
-					&pTypeLib
-					);
-				if (FAILED(code)) {
-					auto tlbfile = self->inprocServer32_.substr(0, self->inprocServer32_.size()-3);
-					tlbfile = tlbfile + L"tlb";
-					code = LoadTypeLibEx(tlbfile.c_str(), REGKIND_NONE, &pTypeLib);
-				}
+	inline EXCEPINFO *except() { return &except_; }
 
-				if (SUCCEEDED(code)) {
-					pTypeLib->AddRef();
-					self->pTypelib_ = pTypeLib;
-				}
-			}
+private:
+	bool Invalid(Isolate *isolate) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return false;
+	}
+
+	DISPID dispid_;
+	std::vector<CComVariant> args_, outs_;
+	std::vector<std::wstring> keys_;
+	CComVariant ret_;
+	CComException except_;
+};
+
+class InvokeOutWorker : public AsyncWorker {
+public:
+	InvokeOutWorker(Nan::Callback *callback, const DispInfoPtr &disp, OutInvocation *invocation)
+	: AsyncWorker(callback)
+	, disp_(disp)
+	, invocation_(invocation)
+	, hrcode_(S_OK) {}
+
+	void Execute() {
+		hrcode_ = invocation_->Invoke(disp_.get());
+		if FAILED(hrcode_) SetErrorMessage("error");
+	}
+
+	void HandleOKCallback() {
+		Nan::HandleScope scope;
+		Local<Value> argv[] = { Nan::Null(), invocation_->Result(Isolate::GetCurrent()) };
+		callback->Call(2, argv, async_resource);
+	}
+
+	void HandleErrorCallback() {
+		Nan::HandleScope scope;
+		Local<Value> argv[] = { DispError(Isolate::GetCurrent(), hrcode_, L"DispInvoke", disp_->name.c_str(), invocation_->except()) };
+		callback->Call(1, argv, async_resource);
+	}
+
+private:
+	DispInfoPtr disp_;
+	std::unique_ptr<OutInvocation> invocation_;
+	HRESULT hrcode_;
+};
+
+// obj.invokeOut(member, inArgs, outTypes[, callback]) -> out values as an array, or as an object when outTypes is { name: type }
+NAN_METHOD(DispObject::NodeInvokeOut) {
+	Isolate *isolate = info.GetIsolate();
+	DispObject *self = DispObject::Unwrap<DispObject>(info.This());
+	if (!self) {
+		isolate->ThrowException(DispErrorInvalid(isolate));
+		return;
+	}
+	if (!self->disp) {
+		isolate->ThrowException(DispErrorNull(isolate));
+		return;
+	}
+	if (info.Length() < 3) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	std::unique_ptr<OutInvocation> invocation(new OutInvocation());
+	if (!invocation->Prepare(isolate, self->disp.get(), info[0], info[1], info[2])) return;
+
+	if (info.Length() > 3 && info[3]->IsFunction()) {
+		Nan::Callback *callback = new Nan::Callback(Nan::To<Function>(info[3]).ToLocalChecked());
+		AsyncQueueWorker(new InvokeOutWorker(callback, self->disp, invocation.release()));
+		return;
+	}
+	HRESULT hrcode = invocation->Invoke(self->disp.get());
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"DispInvoke", self->name.c_str(), invocation->except()));
+		return;
+	}
+	info.GetReturnValue().Set(invocation->Result(isolate));
+}
+
+// Next(celt) of an IEnumVARIANT on the thread pool, the items are converted back on the loop thread
+class EnumWorker : public AsyncWorker {
+public:
+	EnumWorker(Nan::Callback *callback, IEnumVARIANT *ptr, ULONG celt)
+	: AsyncWorker(callback)
+	, ptr_(ptr)
+	, items_(celt)
+	, fetched_(0)
+	, hrcode_(S_OK) {}
+
+	void Execute() {
+		hrcode_ = ptr_->Next((ULONG)items_.size(), &items_.front(), &fetched_);
+		if FAILED(hrcode_) SetErrorMessage("error");
+	}
+
+	void HandleOKCallback() {
+		Nan::HandleScope scope;
+		Isolate *isolate = Isolate::GetCurrent();
+		if (fetched_ > items_.size()) fetched_ = (ULONG)items_.size();
+		Local<Array> batch = Array::New(isolate, (int)fetched_);
+		for (ULONG i = 0; i < fetched_; i++) {
+			batch->Set(i, Variant2ValueOwned(isolate, items_[i], true));
 		}
+		Local<Value> argv[] = { Nan::Null(), batch };
+		callback->Call(2, argv, async_resource);
+	}
+
+	void HandleErrorCallback() {
+		Nan::HandleScope scope;
+		Local<Value> argv[] = { DispError(Isolate::GetCurrent(), hrcode_, L"IEnumVARIANT::Next") };
+		callback->Call(1, argv, async_resource);
 	}
 
-    auto interStr = Get(obj, New("__interface").ToLocalChecked()).ToLocalChecked()->ToString();
-    String::Value vinterface(interStr);
+private:
+	CComPtr<IEnumVARIANT> ptr_;
+	std::vector<CComVariant> items_;
+	ULONG fetched_;
+	HRESULT hrcode_;
+};
 
-	wchar_t szNameBuf[128] = {0};
-	if (!interStr->IsUndefined()) {
-		wcscpy(szNameBuf, (const wchar_t*)*vinterface);
+// ole.enumerate(collection) -> enumerator of the collection's _NewEnum, for ole.fetchBatch
+void DispObject::NodeEnumerate(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	CComVariant var;
+	CComPtr<IDispatch> ptr;
+	if (args.Length() < 1 || !args[0]->IsObject() || !GetValueOf(isolate, args[0]->ToObject(), var) || !VariantDispGet(&var, &ptr)) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
 	}
+	CComPtr<IDispatch> impl;
+	if (ptr->QueryInterface(CLSID_DispEnumImpl, (void**)&impl) == S_OK) {
+		args.GetReturnValue().Set(args[0]);
+		return;
+	}
+	CComVariant ret;
+	HRESULT hrcode = DispInvoke(ptr, DISPID_NEWENUM, 0, 0, &ret, DISPATCH_METHOD | DISPATCH_PROPERTYGET);
+	CComPtr<IEnumVARIANT> enum_ptr;
+	if (SUCCEEDED(hrcode) && (ret.vt == VT_UNKNOWN || ret.vt == VT_DISPATCH) && ret.punkVal) {
+		hrcode = ret.punkVal->QueryInterface(__uuidof(IEnumVARIANT), (void**)&enum_ptr);
+	}
+	else if SUCCEEDED(hrcode) hrcode = DISP_E_TYPEMISMATCH;
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"_NewEnum"));
+		return;
+	}
+	CComPtr<IDispatch> disp;
+	disp.Attach(new DispEnumImpl(enum_ptr));
+	args.GetReturnValue().Set(NodeCreate(isolate, disp, L"Enum", option_none));
+}
+
+// ole.fetchBatch(enumerator, celt, callback(err, items)) -> up to celt items fetched off the loop thread,
+// fewer than celt means the enumeration is over
+NAN_METHOD(DispObject::NodeFetchBatch) {
+	Isolate *isolate = info.GetIsolate();
+	CComVariant var;
+	CComPtr<IDispatch> ptr;
+	CComPtr<IDispatch> impl_ptr;
+	if (info.Length() < 3 || !info[0]->IsObject() || !info[1]->IsUint32() || info[1]->Uint32Value() == 0 || !info[2]->IsFunction() ||
+		!GetValueOf(isolate, info[0]->ToObject(), var) || !VariantDispGet(&var, &ptr) || ptr->QueryInterface(CLSID_DispEnumImpl, (void**)&impl_ptr) != S_OK) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	DispEnumImpl *impl = static_cast<DispEnumImpl*>((IDispatch*)impl_ptr);
+	Nan::Callback *callback = new Nan::Callback(Nan::To<Function>(info[2]).ToLocalChecked());
+	AsyncQueueWorker(new EnumWorker(callback, impl->ptr, info[1]->Uint32Value()));
+}
 
+//-----------------------------------------------------------------------------------
+// Process-wide cache of type libraries and resolved event interfaces
+// Libraries are keyed by typelib GUID or server path, interfaces by (library, interface name)
+
+namespace {
+
+struct event_interface_t {
+	CComPtr<ITypeInfo> info;
 	CLSID clsid;
-	ITypeInfo* pTypeinfo = nullptr;
+};
+
+uv_once_t typelib_cache_once = UV_ONCE_INIT;
+uv_mutex_t typelib_cache_mutex;
+std::map<std::wstring, CComPtr<ITypeLib>> typelib_cache;
+std::map<std::wstring, event_interface_t> interface_cache;
+
+void TypeLibCacheInit() {
+	uv_mutex_init(&typelib_cache_mutex);
+}
+
+HRESULT LoadTypeLibCached(const std::wstring &key, const CLSID *libid, const std::wstring &path, ITypeLib **ptr) {
+	auto it = typelib_cache.find(key);
+	if (it != typelib_cache.end()) {
+		*ptr = it->second;
+		(*ptr)->AddRef();
+		return S_OK;
+	}
+
+	HRESULT hr;
+	if (libid) {
+		hr = LoadRegTypeLib(*libid, 1, 0, 0, ptr);
+	}
+	else if (path.empty()) {
+		hr = TYPE_E_CANTLOADLIBRARY;
+	}
+	else {
+		hr = LoadTypeLibEx(path.c_str(), REGKIND_NONE, ptr);
+		if (FAILED(hr) && path.size() > 3) {
+			auto tlbfile = path.substr(0, path.size() - 3) + L"tlb";
+			hr = LoadTypeLibEx(tlbfile.c_str(), REGKIND_NONE, ptr);
+		}
+	}
+	if (SUCCEEDED(hr)) typelib_cache[key] = *ptr;
+	return hr;
+}
+
+HRESULT FindInterface(ITypeLib *lib, LPOLESTR name, ITypeInfo **ptr, CLSID *clsid) {
 	ITypeInfo* pTypeinfos[5];
 	MEMBERID memid[5];
 	unsigned short found = 5;
-	auto hr = pTypeLib->FindName(szNameBuf, 0, pTypeinfos, memid, &found);
-	pTypeLib->Release();
+	auto hr = lib->FindName(name, 0, pTypeinfos, memid, &found);
+	if (FAILED(hr)) return hr;
 
-	if (FAILED(hr)) {
-		Nan::ThrowError(DispError(Isolate::GetCurrent(), hr, L"FindName", (LPCOLESTR)*vinterface));
-		return;
+	*ptr = nullptr;
+	for (int i = 0; i < found; i++) {
+		if (!*ptr && memid[i] == MEMBERID_NIL) {
+			TYPEATTR* pTypeAttr;
+			if (SUCCEEDED(pTypeinfos[i]->GetTypeAttr(&pTypeAttr))) {
+				if (pTypeAttr->typekind == TKIND_INTERFACE || pTypeAttr->typekind == TKIND_DISPATCH) {
+					*ptr = pTypeinfos[i];
+					*clsid = pTypeAttr->guid;
+				}
+				pTypeinfos[i]->ReleaseTypeAttr(pTypeAttr);
+				if (*ptr) continue;
+			}
+		}
+		pTypeinfos[i]->Release();
 	}
+	return *ptr ? S_OK : TYPE_E_ELEMENTNOTFOUND;
+}
 
-    for (int i=0; i<found; i++) {
-		if (memid[i] == MEMBERID_NIL) {
-
-			TYPEATTR* pTypeAttr;
-            hr = pTypeinfos[i]->GetTypeAttr(&pTypeAttr);
-            if(FAILED(hr)) break;
-
-			if(pTypeAttr->typekind==TKIND_INTERFACE||
-                    pTypeAttr->typekind==TKIND_DISPATCH)
-            {
-                pTypeinfo = pTypeinfos[i];
-				clsid = pTypeAttr->guid;
-            }
+}
 
-			pTypeinfos[i]->ReleaseTypeAttr(pTypeAttr);
+HRESULT DispObject::findEventInterface(const Local<Object> &obj, ITypeInfo **ptr, CLSID *clsid) {
+	Isolate *isolate = Isolate::GetCurrent();
+	uv_once(&typelib_cache_once, TypeLibCacheInit);
 
-			if (pTypeinfo)
-				break;
+	// library key
+	HRESULT hr;
+	CLSID libid;
+	bool has_libid = false;
+	std::wstring libkey;
+	if (Nan::Has(obj, New("__typelib").ToLocalChecked()).FromJust()) {
+		auto typeClsid = Get(obj, New("__typelib").ToLocalChecked()).ToLocalChecked()->ToString();
+		String::Value vname(typeClsid);
+		hr = CLSIDFromString((LPCOLESTR)*vname, &libid);
+		if (FAILED(hr)) {
+			Nan::ThrowError(DispError(isolate, hr, L"GetConnectionTypeInfo", (LPCOLESTR)*vname));
+			return hr;
 		}
+		wchar_t guid_buf[64];
+		StringFromGUID2(libid, guid_buf, 64);
+		libkey = guid_buf;
+		has_libid = true;
+	}
+	else {
+		libkey = inprocServer32_;
+		for (auto& c : libkey) c = towlower(c);
 	}
 
-	if (FAILED(hr) || !pTypeinfo) {
-		Nan::ThrowError(DispError(Isolate::GetCurrent(), hr, L"LoadTypeInfo", (LPCOLESTR)*vinterface));
-		return;
+	auto interStr = Get(obj, New("__interface").ToLocalChecked()).ToLocalChecked();
+	String::Value vinterface(interStr);
+	std::wstring iface;
+	if (!interStr->IsUndefined()) iface.assign((LPOLESTR)*vinterface, vinterface.length());
+	std::wstring ifacekey = libkey + L"|" + iface;
+
+	uv_mutex_lock(&typelib_cache_mutex);
+	auto it = interface_cache.find(ifacekey);
+	if (it != interface_cache.end()) {
+		*ptr = it->second.info;
+		(*ptr)->AddRef();
+		*clsid = it->second.clsid;
+		uv_mutex_unlock(&typelib_cache_mutex);
+		return S_OK;
+	}
+
+	CComPtr<ITypeLib> lib;
+	hr = LoadTypeLibCached(libkey, has_libid ? &libid : nullptr, inprocServer32_, &lib);
+	if (FAILED(hr)) {
+		uv_mutex_unlock(&typelib_cache_mutex);
+		Nan::ThrowError(DispError(isolate, hr, has_libid ? L"LoadRegTypeLib" : L"LoadTypeLib", libkey.c_str()));
+		return hr;
+	}
+
+	hr = FindInterface(lib, (LPOLESTR)iface.c_str(), ptr, clsid);
+	if (SUCCEEDED(hr)) {
+		event_interface_t &entry = interface_cache[ifacekey];
+		entry.info = *ptr;
+		entry.clsid = *clsid;
+	}
+	uv_mutex_unlock(&typelib_cache_mutex);
+
+	if (FAILED(hr)) {
+		Nan::ThrowError(DispError(isolate, hr, L"LoadTypeInfo", iface.c_str()));
+	}
+	return hr;
+}
+
+HRESULT DispObject::advise(const Local<Object> &spec, const Local<Object> &sink, CLSID *clsid, IConnectionPoint **ppoint, DWORD *cookie, CComPtr<IUnknown> &unk, DispatchCallback **callback) {
+	ITypeInfo* pTypeinfo = nullptr;
+	auto hr = findEventInterface(spec, &pTypeinfo, clsid);
+	if (FAILED(hr)) {
+		return hr;
 	}
 
     CComPtr<IConnectionPointContainer> cp_cont;
 
     bool throwed = false;
-    hr = self->disp->ptr->QueryInterface(&cp_cont);
+    hr = disp->ptr->QueryInterface(&cp_cont);
     if (SUCCEEDED(hr)) {
 		CComPtr<IConnectionPoint> point;
-		hr = cp_cont->FindConnectionPoint(clsid, &point);
+		hr = cp_cont->FindConnectionPoint(*clsid, &point);
 
 		if (SUCCEEDED(hr) && point) {
-            CComPtr<IUnknown> unk;
-            auto callbackObj = new DispatchCallback(obj, clsid, pTypeinfo);
+            auto callbackObj = new DispatchCallback(sink, *clsid, pTypeinfo);
+            pTypeinfo = nullptr;
+            unk = callbackObj;
             hr = callbackObj->initHResult();
 
             if (SUCCEEDED(hr)) {
-                unk.Attach(callbackObj);
-
-                DWORD dwCookie;
-                hr = point->Advise(unk, &dwCookie);
+                hr = point->Advise(unk, cookie);
                 if (SUCCEEDED(hr)) {
-                    self->connections_.insert(std::make_pair(dwCookie, connection_t{clsid, unk}));
-                    info.GetReturnValue().Set(New((uint32_t)dwCookie));
+                    callbackObj->Advised(point, *cookie);
+                    *callback = callbackObj;
+                    if (ppoint) *ppoint = point.Detach();
                 }
             } else {
                 throwed = true;
-                callbackObj->Release();
             }
             
             point.Release();
 		}
         cp_cont.Release();			
     }
+    if (pTypeinfo) pTypeinfo->Release();
 
     if (!SUCCEEDED(hr)) {
+        unk.Release();
         if (!throwed)
 		    ThrowError(DispError(Isolate::GetCurrent(), hr, L"ConnectionAdvise"));
+	}
+	return hr;
+}
+
+NAN_METHOD(DispObject::ConnectionAdvise) {
+
+    if (info.Length() < 1 || info[0].IsEmpty() || !info[0]->IsObject()) {
+        ThrowError("callbackAdvise 1'st paramter should be object");
+        return;
+    }
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto obj = info[0]->ToObject();
+
+	CLSID clsid;
+	DWORD dwCookie;
+	CComPtr<IUnknown> unk;
+	DispatchCallback *callbackObj;
+	if (FAILED(self->advise(obj, obj, &clsid, nullptr, &dwCookie, unk, &callbackObj))) {
 		return;
 	}
+	self->connections_.insert(std::make_pair(dwCookie, connection_t{clsid, unk, callbackObj}));
+	info.GetReturnValue().Set(New((uint32_t)dwCookie));
+}
+
+// callbackAdviseOnce(iface, method[, timeout]) -> Promise of the event arguments
+// the connection is unadvised as soon as the event arrives, the deadline expires or promise.cancel() is called
+NAN_METHOD(DispObject::ConnectionAdviseOnce) {
+	Isolate *isolate = Isolate::GetCurrent();
+	if (info.Length() < 2 || !(info[0]->IsString() || info[0]->IsObject()) || !info[1]->IsString()) {
+		ThrowError("callbackAdviseOnce expects interface and event name");
+		return;
+	}
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	Local<Object> spec;
+	if (info[0]->IsObject()) spec = info[0]->ToObject();
+	else {
+		spec = Nan::New<Object>();
+		Nan::Set(spec, New("__interface").ToLocalChecked(), info[0]);
+	}
+	uint32_t timeout = (info.Length() > 2 && info[2]->IsUint32()) ? info[2]->Uint32Value() : 0;
+
+	auto waiter = new EventWaiter(isolate);
+	Local<Object> sink = Nan::New<Object>();
+	Nan::Set(sink, info[1]->ToString(), waiter->NewFireFunction(isolate));
+
+	CLSID clsid;
+	DWORD dwCookie;
+	CComPtr<IUnknown> unk;
+	CComPtr<IConnectionPoint> point;
+	DispatchCallback *callbackObj;
+	if (FAILED(self->advise(spec, sink, &clsid, &point, &dwCookie, unk, &callbackObj))) {
+		delete waiter;
+		return;
+	}
+	waiter->Start(point, dwCookie, timeout);
+
+	Local<Promise> promise = waiter->GetPromise(isolate);
+	Nan::Set(promise, New("cancel").ToLocalChecked(), waiter->NewCancelFunction(isolate));
+	info.GetReturnValue().Set(promise);
 }
 
 NAN_METHOD(DispObject::ConnectionUnadvise) {
@@ -907,3 +1593,223 @@ NAN_METHOD(DispObject::ConnectionUnadvise) {
         }
 	}
 }
+
+NAN_METHOD(DispObject::ConnectionRebind) {
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	if (it == self->connections_.end()) {
+		info.GetReturnValue().Set(false);
+		return;
+	}
+
+	// rebind to a new sink object or re-read the handlers of the current one
+	Local<Object> obj;
+	if (info.Length() > 1 && info[1]->IsObject()) obj = info[1]->ToObject();
+	else obj = it->second.callback->sinkObject();
+	it->second.callback->bindCallbacks(obj);
+	info.GetReturnValue().Set(true);
+}
+
+// callbackStats(cookie[, reset]) -> { count, mean, p50, p99, max } of queue latency in milliseconds
+NAN_METHOD(DispObject::ConnectionStats) {
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	if (it == self->connections_.end()) {
+		return;
+	}
+
+	LatencyHistogram &latency = it->second.callback->latency();
+	info.GetReturnValue().Set(latency.ToObject(Isolate::GetCurrent()));
+	if (info.Length() > 1 && v8val2bool(info[1], false)) latency.Reset();
+}
+
+// callbackMirror(cookie) -> all mirrored values
+// callbackMirror(cookie, name) -> mirrored value or undefined
+// callbackMirror(cookie, name, value) -> seed a value not yet delivered by an event, undefined removes it
+NAN_METHOD(DispObject::ConnectionMirror) {
+	Isolate *isolate = Isolate::GetCurrent();
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	VariantMirror *mirror = (it != self->connections_.end()) ? it->second.callback->mirror() : nullptr;
+	if (!mirror) {
+		return;
+	}
+
+	if (info.Length() < 2) {
+		info.GetReturnValue().Set(mirror->ToObject(isolate));
+		return;
+	}
+
+	String::Value vname(info[1]);
+	std::wstring name((LPOLESTR)*vname, vname.length());
+	if (info.Length() > 2) {
+		if (info[2]->IsUndefined()) mirror->Remove(name);
+		else {
+			CComVariant value;
+			Value2Variant(isolate, info[2], value);
+			info.GetReturnValue().Set(mirror->Seed(name, value));
+		}
+		return;
+	}
+
+	CComVariant value;
+	if (mirror->Get(name, &value)) {
+		info.GetReturnValue().Set(Variant2ValueOwned(isolate, value));
+	}
+}
+
+NAN_METHOD(DispObject::ConnectionMirrorVersion) {
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	VariantMirror *mirror = (it != self->connections_.end()) ? it->second.callback->mirror() : nullptr;
+	if (mirror) {
+		info.GetReturnValue().Set((double)mirror->Version());
+	}
+}
+
+// callbackSeries(cookie) -> keys with samples
+// callbackSeries(cookie, key[, { from, to, buckets }]) -> { time: Float64Array, value: Float64Array }
+NAN_METHOD(DispObject::ConnectionSeries) {
+	Isolate *isolate = Isolate::GetCurrent();
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	SeriesBuffer *series = (it != self->connections_.end()) ? it->second.callback->series() : nullptr;
+	if (!series) {
+		return;
+	}
+
+	if (info.Length() < 2) {
+		info.GetReturnValue().Set(series->Keys(isolate));
+		return;
+	}
+
+	String::Value vkey(info[1]);
+	std::wstring key((LPOLESTR)*vkey, vkey.length());
+	double from = -INFINITY, to = INFINITY;
+	uint32_t buckets = 0;
+	if (info.Length() > 2 && info[2]->IsObject()) {
+		auto options = info[2]->ToObject();
+		auto val = Nan::Get(options, Nan::New("from").ToLocalChecked()).ToLocalChecked();
+		if (val->IsNumber()) from = val->NumberValue();
+		val = Nan::Get(options, Nan::New("to").ToLocalChecked()).ToLocalChecked();
+		if (val->IsNumber()) to = val->NumberValue();
+		val = Nan::Get(options, Nan::New("buckets").ToLocalChecked()).ToLocalChecked();
+		if (val->IsUint32()) buckets = val->Uint32Value();
+	}
+	info.GetReturnValue().Set(series->Query(isolate, key, from, to, buckets));
+}
+
+NAN_METHOD(DispObject::ConnectionSeriesClear) {
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	SeriesBuffer *series = (it != self->connections_.end()) ? it->second.callback->series() : nullptr;
+	if (!series) {
+		return;
+	}
+
+	if (info.Length() > 1 && !info[1]->IsUndefined()) {
+		String::Value vkey(info[1]);
+		std::wstring key((LPOLESTR)*vkey, vkey.length());
+		series->Clear(&key);
+	}
+	else {
+		series->Clear(nullptr);
+	}
+}
+
+// callbackStopRules(cookie) -> { armed, fired, rule }
+// callbackStopRules(cookie, event, target, method, rules) -> call target.method() as soon as a rule on the event matches
+NAN_METHOD(DispObject::ConnectionStopRules) {
+	Isolate *isolate = Isolate::GetCurrent();
+	if (info.Length() < 1) {
+		return;
+	}
+
+	auto dwCookie = info[0]->Uint32Value();
+
+	auto self = DispObject::Unwrap<DispObject>(info.This());
+	auto it = self->connections_.find(dwCookie);
+	if (it == self->connections_.end()) {
+		return;
+	}
+
+	DispatchCallback *callback = it->second.callback;
+	if (info.Length() < 2) {
+		info.GetReturnValue().Set(callback->stopRules().ToObject(isolate));
+		return;
+	}
+
+	if (info.Length() < 5) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+
+	String::Value vevent(info[1]);
+	LPOLESTR eventName[] = { (LPOLESTR)*vevent };
+	DISPID eventId;
+	HRESULT hr = callback->GetIDsOfNames(IID_NULL, eventName, 1, LOCALE_SYSTEM_DEFAULT, &eventId);
+	if FAILED(hr) {
+		isolate->ThrowException(DispError(isolate, hr, eventName[0]));
+		return;
+	}
+
+	CComPtr<IUnknown> unk;
+	CComPtr<IDispatch> target;
+	Local<Value> targetVal = info[2];
+	if (!Value2Unknown(isolate, targetVal, &unk) || !UnknownDispGet(unk, &target)) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+
+	String::Value vmethod(info[3]);
+	LPOLESTR methodName = (LPOLESTR)*vmethod;
+	DISPID methodId;
+	hr = DispFind(target, methodName, &methodId);
+	if FAILED(hr) {
+		isolate->ThrowException(DispError(isolate, hr, methodName));
+		return;
+	}
+
+	if (!callback->stopRules().Set(eventId, target, methodId, info[4])) {
+		isolate->ThrowException(InvalidArgumentsError(isolate));
+		return;
+	}
+	info.GetReturnValue().Set(true);
+}
+
@@ -1,15 +1,21 @@
 #pragma once
 #include "disp.h"
 
+class DispatchCallback;
+
 class DispObject: public ObjectWrap
 {
 public:
 	DispObject(const DispInfoPtr &ptr, const std::wstring &name, DISPID id = DISPID_UNKNOWN, LONG indx = -1, int opt = 0, const std::wstring& inprocServer32 = L"");
 	~DispObject();
 
-	static Persistent<ObjectTemplate> inst_template;
-	static Persistent<FunctionTemplate> clazz_template;
+	// per isolate, every thread running the module has its own templates
+	static thread_local Persistent<ObjectTemplate> inst_template;
+	static thread_local Persistent<FunctionTemplate> clazz_template;
+	// live wrappers of the calling thread
+	static thread_local std::set<DispObject*> instances;
 	static void NodeInit(const Local<Object> &target);
+	static void NodeCleanup();
 	static bool HasInstance(Isolate *isolate, const Local<Value> &obj) {
 		Local<FunctionTemplate> clazz = clazz_template.Get(isolate);
 		return !clazz.IsEmpty() && clazz->HasInstance(obj);
@@ -18,7 +24,7 @@ public:
 		Local<FunctionTemplate> clazz = clazz_template.Get(isolate);
 		if (clazz.IsEmpty() || !clazz->HasInstance(obj)) return false;
 		DispObject *self = Unwrap<DispObject>(obj);
-		return self && SUCCEEDED(self->valueOf(isolate, value));
+		return self && SUCCEEDED(self->argumentOf(isolate, value));
 	}
 	static Local<Object> NodeCreate(Isolate *isolate, IDispatch *disp, const std::wstring &name, int opt) {
 		Local<Object> parent;
@@ -34,13 +40,32 @@ private:
 	static void NodeToString(const FunctionCallbackInfo<Value> &args);
 	static void NodeRelease(const FunctionCallbackInfo<Value> &args);
 	static void NodeCast(const FunctionCallbackInfo<Value> &args);
+	static void NodeBag(const FunctionCallbackInfo<Value> &args);
+	static void NodeOptions(const FunctionCallbackInfo<Value> &args);
+	static void NodeStringStats(const FunctionCallbackInfo<Value> &args);
+	static void NodeCallStats(const FunctionCallbackInfo<Value> &args);
+	static void NodeShare(const FunctionCallbackInfo<Value> &args);
+	static void NodeUnshare(const FunctionCallbackInfo<Value> &args);
+	static void NodeFromShared(const FunctionCallbackInfo<Value> &args);
+	static void NodeSnapshot(const FunctionCallbackInfo<Value> &args);
+	static void NodeEnumerate(const FunctionCallbackInfo<Value> &args);
+	static NAN_METHOD(NodeFetchBatch);
     static void NodeGet(Local<String> name, const PropertyCallbackInfo<Value> &args);
 	static void NodeSet(Local<String> name, Local<Value> value, const PropertyCallbackInfo<Value> &args);
 	static void NodeGetByIndex(uint32_t index, const PropertyCallbackInfo<Value> &args);
 	static void NodeSetByIndex(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value> &args);
 	static NAN_METHOD(NodeCall);
+	static NAN_METHOD(NodeInvokeOut);
 	static NAN_METHOD(ConnectionAdvise);
 	static NAN_METHOD(ConnectionUnadvise);
+	static NAN_METHOD(ConnectionAdviseOnce);
+	static NAN_METHOD(ConnectionRebind);
+	static NAN_METHOD(ConnectionStats);
+	static NAN_METHOD(ConnectionMirror);
+	static NAN_METHOD(ConnectionMirrorVersion);
+	static NAN_METHOD(ConnectionSeries);
+	static NAN_METHOD(ConnectionSeriesClear);
+	static NAN_METHOD(ConnectionStopRules);
 
 protected:
 	bool release();
@@ -49,6 +74,7 @@ protected:
 	void call(Isolate *isolate, const Nan::FunctionCallbackInfo<Value> &args);
 
 	HRESULT valueOf(Isolate *isolate, VARIANT &value);
+	HRESULT argumentOf(Isolate *isolate, VARIANT &value);
 	HRESULT valueOf(Isolate *isolate, const Local<Object> &self, Local<Value> &value);
 	void toString(const FunctionCallbackInfo<Value> &args);
     Local<Value> getIdentity(Isolate *isolate);
@@ -73,13 +99,15 @@ private:
 	struct connection_t {
 		CLSID clsid;
 		CComPtr<IUnknown> unk;
+		DispatchCallback *callback;
 	};
 	std::map<DWORD, connection_t> connections_;
 
-	LPTYPELIB pTypelib_;
 	std::wstring inprocServer32_;
 	static bool is64arch;
 
 	HRESULT prepare();
+	HRESULT findEventInterface(const Local<Object> &obj, ITypeInfo **ptr, CLSID *clsid);
+	HRESULT advise(const Local<Object> &spec, const Local<Object> &sink, CLSID *clsid, IConnectionPoint **ppoint, DWORD *cookie, CComPtr<IUnknown> &unk, DispatchCallback **callback);
 };
 
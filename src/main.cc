@@ -8,15 +8,44 @@
 #include "dispatch_callback.h"
 
 
+// worker_threads load the module in their own isolate, node 10.7+
+#if NODE_MAJOR_VERSION > 10 || (NODE_MAJOR_VERSION == 10 && NODE_MINOR_VERSION >= 7)
+#define CONTEXT_AWARE_MODULE
+#endif
+
+static thread_local bool com_initialized = false;
+
+static void cleanup(void *arg) {
+	DispatchCallback::Cleanup((Isolate*)arg);
+	VariantObject::NodeCleanup();
+	DispObject::NodeCleanup();
+	if (com_initialized) CoUninitialize();
+	com_initialized = false;
+}
+
 NAN_MODULE_INIT(init) {
     Nan::HandleScope scope;
 
+	// the loading thread joins the multithreaded apartment, DllMain only covers the first one
+	com_initialized = SUCCEEDED(CoInitializeEx(0, COINIT_MULTITHREADED));
+
     DispObject::NodeInit(target);
 	VariantObject::NodeInit(target);
     DispatchCallback::Initialize(target);
+
+#ifdef CONTEXT_AWARE_MODULE
+	Isolate *isolate = target->GetIsolate();
+	node::AddEnvironmentCleanupHook(isolate, cleanup, isolate);
+#endif
 }
 
+#ifdef CONTEXT_AWARE_MODULE
+NODE_MODULE_INIT(/* exports, module, context */) {
+	init(exports);
+}
+#else
 NODE_MODULE(ole_bindings, init)
+#endif
 
 //----------------------------------------------------------------------------------
 
@@ -2,6 +2,7 @@
 #include "utils.h"
 
 const GUID CLSID_DispObjectImpl = { 0x9dce8520, 0x2efe, 0x48c0,{ 0xa0, 0xdc, 0x95, 0x1b, 0x29, 0x18, 0x72, 0xc0 } };
+const GUID CLSID_DispEnumImpl = { 0x3f1d7c52, 0x8a4b, 0x4e0d,{ 0x9c, 0x61, 0x2b, 0x5e, 0x7a, 0x90, 0xd4, 0xc3 } };
 
 
 //-------------------------------------------------------------------------------------------------------
@@ -16,6 +16,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <memory>
 #include <initializer_list>
 
@@ -66,6 +67,11 @@ public:
         *dst = *this;
         vt = VT_EMPTY;
     }
+	inline void Attach(VARIANT *src) {
+		Clear();
+		*(VARIANT*)this = *src;
+		src->vt = VT_EMPTY;
+	}
 	inline HRESULT CopyTo(VARIANT *dst) {
 		return VariantCopy(dst, this);
 	}
@@ -77,16 +83,27 @@ public:
 	inline ULONG ArrayLength() {
 		if ((vt & VT_ARRAY) == 0) return 0;
 		SAFEARRAY *varr = (vt & VT_BYREF) != 0 ? *pparray : parray;
-		return varr ? varr->rgsabound[0].cElements : 0;
+		if (!varr) return 0;
+		ULONG cnt = 1;
+		for (USHORT d = 0; d < varr->cDims; d++) cnt *= varr->rgsabound[d].cElements;
+		return cnt;
 	}
 
+	// index in storage order, so every dimension is reachable
 	inline HRESULT ArrayGet(LONG index, CComVariant &var) {
 		if ((vt & VT_ARRAY) == 0) return E_NOTIMPL;
 		SAFEARRAY *varr = (vt & VT_BYREF) != 0 ? *pparray : parray;
-		if (!varr) return E_FAIL;
-		index += varr->rgsabound[0].lLbound;
+		if (!varr || varr->cDims == 0) return E_FAIL;
+		// also covers empty arrays, no dimension below is zero
+		if (index < 0 || (ULONG)index >= ArrayLength()) return DISP_E_BADINDEX;
+		std::vector<LONG> indices(varr->cDims);
+		for (USHORT d = varr->cDims; d-- > 0; ) {
+			indices[d] = varr->rgsabound[d].lLbound + (LONG)(index % varr->rgsabound[d].cElements);
+			index /= varr->rgsabound[d].cElements;
+		}
+		if (index != 0) return DISP_E_BADINDEX;
 		VARTYPE vart = vt & VT_TYPEMASK;
-		HRESULT hr = SafeArrayGetElement(varr, &index, (vart == VT_VARIANT) ? (void*)&var : (void*)&var.byref);
+		HRESULT hr = SafeArrayGetElement(varr, &indices[0], (vart == VT_VARIANT) ? (void*)&var : (void*)&var.byref);
 		if (SUCCEEDED(hr) && vart != VT_VARIANT) var.vt = vart;
 		return hr;
 	}
@@ -116,6 +133,7 @@ public:
     inline void Attach(BSTR _p) { Free(); p = _p; }
     inline BSTR Detach() { BSTR pp = p; p = 0; return pp; }
     inline void Free() { if (p) { SysFreeString(p); p = 0; } }
+    inline UINT Length() const { return p ? SysStringLen(p) : 0; }
 
     inline operator BSTR () const { return p; }
     inline BSTR* operator&() { return &p; }
@@ -232,12 +250,21 @@ public:
 
 
 
+// {3F1D7C52-8A4B-4E0D-9C61-2B5E7A90D4C3}
+extern const GUID CLSID_DispEnumImpl;
+
 class DispEnumImpl : public UnknownImpl<IDispatch> {
 public:
     CComPtr<IEnumVARIANT> ptr;
     DispEnumImpl() {}
     DispEnumImpl(IEnumVARIANT *p) : ptr(p) {}
 
+	// IUnknown interface
+	virtual HRESULT __stdcall QueryInterface(REFIID qiid, void **ppvObject) {
+		if (qiid == CLSID_DispEnumImpl) { *ppvObject = this; AddRef(); return S_OK; }
+		return UnknownImpl<IDispatch>::QueryInterface(qiid, ppvObject);
+	}
+
     // IDispatch interface
     virtual HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT *pctinfo) { *pctinfo = 0; return S_OK; }
     virtual HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo) { return E_NOTIMPL; }
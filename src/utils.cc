@@ -68,28 +68,582 @@ char *GetWin32ErroroMessage(char *buf, size_t buflen, Isolate *isolate, HRESULT
 
 Local<String> GetWin32ErroroMessage(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2, LPCOLESTR desc) {
 	uint16_t buf_wide[ERROR_MESSAGE_WIDE_MAXSIZE];
-	return String::NewFromTwoByte(isolate, GetWin32ErroroMessage(buf_wide, ERROR_MESSAGE_WIDE_MAXSIZE, isolate, hrcode, msg, msg2, desc));
+	return NewCompactString(isolate, (const wchar_t*)GetWin32ErroroMessage(buf_wide, ERROR_MESSAGE_WIDE_MAXSIZE, isolate, hrcode, msg, msg2, desc));
 }
 
 //-------------------------------------------------------------------------------------------------------
 
-Local<Value> Variant2Array(Isolate *isolate, const VARIANT &v) {
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NARROW_SIMD
+#include <intrin.h>
+
+static bool CpuHasAVX2() {
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuid(info, 1);
+	// AVX with the ymm state enabled by the OS
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+	if ((_xgetbv(0) & 6) != 6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+static const bool has_avx2 = CpuHasAVX2();
+
+// 32 code units per round, the pack works per 128-bit lane so the quadwords are put back in order
+static size_t NarrowAVX2(const wchar_t *src, size_t len, uint8_t *dst) {
+	const __m256i high = _mm256_set1_epi16((short)0xFF00);
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 16));
+		if (!_mm256_testz_si256(_mm256_or_si256(a, b), high)) break;
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i*)(dst + i), packed);
+	}
+	_mm256_zeroupper();
+	return i;
+}
+
+// 16 code units per round
+static size_t NarrowSSE2(const wchar_t *src, size_t len, uint8_t *dst) {
+	const __m128i high = _mm_set1_epi16((short)0xFF00);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+		__m128i test = _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high), zero);
+		if (_mm_movemask_epi8(test) != 0xFFFF) break;
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+	}
+	return i;
+}
+#endif
+
+bool NarrowLatin1(const wchar_t *src, size_t len, uint8_t *dst) {
+	size_t i = 0;
+#ifdef NARROW_SIMD
+	if (has_avx2) i = NarrowAVX2(src, len, dst);
+	i += NarrowSSE2(src + i, len - i, dst + i);
+#endif
+	// tail, or the block where a wide code unit showed up
+	for (; i < len; i++) {
+		if (src[i] > 0xFF) return false;
+		dst[i] = (uint8_t)src[i];
+	}
+	return true;
+}
+
+Local<String> NewCompactString(Isolate *isolate, const wchar_t *str, int len, NewStringType type) {
+	if (!str) return String::Empty(isolate);
+	if (len < 0) len = (int)wcslen(str);
+	if (ConvertOptions::Current().compactStrings) {
+		uint8_t local[256];
+		std::unique_ptr<uint8_t[]> heap;
+		uint8_t *buf = local;
+		if ((size_t)len > sizeof(local)) {
+			heap.reset(new uint8_t[len]);
+			buf = heap.get();
+		}
+		if (NarrowLatin1(str, (size_t)len, buf)) {
+			MaybeLocal<String> result = String::NewFromOneByte(isolate, buf, type, len);
+			if (!result.IsEmpty()) return result.ToLocalChecked();
+		}
+	}
+	MaybeLocal<String> result = String::NewFromTwoByte(isolate, (const uint16_t*)str, type, len);
+	return result.IsEmpty() ? String::Empty(isolate) : result.ToLocalChecked();
+}
+
+ConvertOptions &ConvertOptions::Current() {
+	static thread_local ConvertOptions options;
+	return options;
+}
+
+void ConvertOptions::Read(const Local<Value> &val) {
+	if (val.IsEmpty() || !val->IsObject()) return;
+	Local<Object> obj = val->ToObject();
+	Local<Value> typed = Nan::Get(obj, Nan::New("typedArrays").ToLocalChecked()).ToLocalChecked();
+	if (!typed->IsUndefined()) typedArrays = typed->BooleanValue();
+	Local<Value> intern = Nan::Get(obj, Nan::New("internStrings").ToLocalChecked()).ToLocalChecked();
+	if (!intern->IsUndefined()) internStrings = intern->BooleanValue();
+	Local<Value> capacity = Nan::Get(obj, Nan::New("internCapacity").ToLocalChecked()).ToLocalChecked();
+	if (capacity->IsUint32()) internCapacity = capacity->Uint32Value();
+	Local<Value> external = Nan::Get(obj, Nan::New("externalStrings").ToLocalChecked()).ToLocalChecked();
+	if (external->IsUint32()) externalStrings = external->Uint32Value();
+	else if (external->IsBoolean()) externalStrings = external->BooleanValue() ? ConvertOptions().externalStrings : 0;
+	Local<Value> compact = Nan::Get(obj, Nan::New("compactStrings").ToLocalChecked()).ToLocalChecked();
+	if (!compact->IsUndefined()) compactStrings = compact->BooleanValue();
+	Local<Value> lazy = Nan::Get(obj, Nan::New("lazyArrays").ToLocalChecked()).ToLocalChecked();
+	if (lazy->IsUint32()) lazyArrays = lazy->Uint32Value();
+	else if (lazy->IsBoolean()) lazyArrays = lazy->BooleanValue() ? 1 : 0;
+	Local<Value> lazy_args = Nan::Get(obj, Nan::New("lazyArguments").ToLocalChecked()).ToLocalChecked();
+	if (!lazy_args->IsUndefined()) lazyArguments = lazy_args->BooleanValue();
+}
+
+Local<Object> ConvertOptions::ToObject(Isolate *isolate) const {
+	Local<Object> obj = Object::New(isolate);
+	obj->Set(String::NewFromUtf8(isolate, "typedArrays"), Boolean::New(isolate, typedArrays));
+	obj->Set(String::NewFromUtf8(isolate, "internStrings"), Boolean::New(isolate, internStrings));
+	obj->Set(String::NewFromUtf8(isolate, "internCapacity"), Uint32::New(isolate, internCapacity));
+	obj->Set(String::NewFromUtf8(isolate, "externalStrings"), Uint32::New(isolate, externalStrings));
+	obj->Set(String::NewFromUtf8(isolate, "compactStrings"), Boolean::New(isolate, compactStrings));
+	obj->Set(String::NewFromUtf8(isolate, "lazyArrays"), Uint32::New(isolate, lazyArrays));
+	obj->Set(String::NewFromUtf8(isolate, "lazyArguments"), Boolean::New(isolate, lazyArguments));
+	return obj;
+}
+
+StringCache &StringCache::Current() {
+	static thread_local StringCache cache;
+	return cache;
+}
+
+void StringCache::Resize(uint32_t capacity) {
+	uint32_t size = 1;
+	while (size < capacity) size <<= 1;
+	if (capacity == 0) size = 0;
+	if (size == slots_.size()) return;
+	Clear();
+	slots_.resize(size);
+}
+
+void StringCache::Clear() {
+	for (auto &slot : slots_) {
+		slot.key.clear();
+		slot.value.Reset();
+	}
+}
+
+Local<String> StringCache::Get(Isolate *isolate, const wchar_t *str, int len) {
+	// FNV-1a over the code units
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < len; i++) hash = (hash ^ str[i]) * 16777619u;
+	slot_t &slot = slots_[hash & (slots_.size() - 1)];
+	if (!slot.value.IsEmpty() && slot.key.length() == (size_t)len && wmemcmp(slot.key.c_str(), str, len) == 0) {
+		hits++;
+		return slot.value.Get(isolate);
+	}
+	misses++;
+	Local<String> value = NewCompactString(isolate, str, len, NewStringType::kInternalized);
+	slot.key.assign(str, len);
+	slot.value.Reset(isolate, value);
+	return value;
+}
+
+Local<Object> StringCache::Stats(Isolate *isolate) const {
+	size_t used = 0;
+	for (auto &slot : slots_) if (!slot.value.IsEmpty()) used++;
+	Local<Object> obj = Object::New(isolate);
+	obj->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, (double)hits));
+	obj->Set(String::NewFromUtf8(isolate, "misses"), Number::New(isolate, (double)misses));
+	obj->Set(String::NewFromUtf8(isolate, "hitRate"), Number::New(isolate, (hits + misses) ? (double)hits / (hits + misses) : 0.));
+	obj->Set(String::NewFromUtf8(isolate, "size"), Number::New(isolate, (double)used));
+	obj->Set(String::NewFromUtf8(isolate, "capacity"), Number::New(isolate, (double)slots_.size()));
+	return obj;
+}
+
+BstrResource::BstrResource(Isolate *isolate, BSTR bstr)
+: isolate_(isolate)
+, bstr_(bstr)
+, length_(SysStringLen(bstr)) {
+	isolate_->AdjustAmountOfExternalAllocatedMemory((int64_t)(length_ * sizeof(WCHAR)));
+}
+
+BstrResource::~BstrResource() {
+	isolate_->AdjustAmountOfExternalAllocatedMemory(-(int64_t)(length_ * sizeof(WCHAR)));
+	if (bstr_) SysFreeString(bstr_);
+}
+
+Local<String> Bstr2StringOwned(Isolate *isolate, BSTR &bstr) {
+	uint32_t threshold = ConvertOptions::Current().externalStrings;
+	if (!bstr || threshold == 0 || SysStringLen(bstr) < threshold) return Bstr2String(isolate, bstr);
+	BstrResource *resource = new BstrResource(isolate, bstr);
+	Nan::MaybeLocal<String> str = Nan::New<String>(resource);
+	if (str.IsEmpty()) {
+		// too long for V8, the resource was not adopted
+		resource->Detach();
+		delete resource;
+		return Bstr2String(isolate, bstr);
+	}
+	bstr = nullptr;
+	return str.ToLocalChecked();
+}
+
+// every COM string reaching JS goes through here
+Local<String> Bstr2String(Isolate *isolate, const wchar_t *str, int len) {
+	if (!str || len <= 0) return String::Empty(isolate);
+	const ConvertOptions &opts = ConvertOptions::Current();
+	if (opts.internStrings && len <= StringCache::max_length && opts.internCapacity > 0) {
+		StringCache &cache = StringCache::Current();
+		cache.Resize(opts.internCapacity);
+		return cache.Get(isolate, str, len);
+	}
+	return NewCompactString(isolate, str, len);
+}
+
+// dimensions leftmost first, the storage is column-major so the leftmost index varies fastest
+// rgsabound holds the dimensions in reverse order
+size_t SafeArrayShape(SAFEARRAY *varr, std::vector<ULONG> &shape, std::vector<size_t> &strides) {
+	size_t count = 1;
+	shape.resize(varr->cDims);
+	strides.resize(varr->cDims);
+	for (USHORT d = 0; d < varr->cDims; d++) {
+		shape[d] = varr->rgsabound[varr->cDims - d - 1].cElements;
+		strides[d] = count;
+		count *= shape[d];
+	}
+	return count;
+}
+
+// numeric arrays are copied as one block, 64 bit integers are widened to doubles
+Local<Value> SafeArray2TypedArray(Isolate *isolate, SAFEARRAY *varr, VARTYPE vt) {
+	size_t elsize;
+	switch (vt) {
+	case VT_I1: case VT_UI1: elsize = 1; break;
+	case VT_I2: case VT_UI2: elsize = 2; break;
+	case VT_I4: case VT_UI4: case VT_INT: case VT_UINT: case VT_R4: elsize = 4; break;
+	case VT_I8: case VT_UI8: case VT_R8: elsize = 8; break;
+	default: return Local<Value>();
+	}
+	if (!varr || varr->cDims == 0 || varr->cbElements != elsize) return Local<Value>();
+
+	size_t cnt = 1;
+	for (USHORT d = 0; d < varr->cDims; d++) cnt *= varr->rgsabound[d].cElements;
+	void *data;
+	if FAILED(SafeArrayAccessData(varr, &data)) return Local<Value>();
+	Local<ArrayBuffer> buf = ArrayBuffer::New(isolate, cnt * elsize);
+	void *dst = buf->GetContents().Data();
+	if (vt == VT_I8) {
+		for (size_t i = 0; i < cnt; i++) ((double*)dst)[i] = (double)((LONGLONG*)data)[i];
+	}
+	else if (vt == VT_UI8) {
+		for (size_t i = 0; i < cnt; i++) ((double*)dst)[i] = (double)((ULONGLONG*)data)[i];
+	}
+	else if (cnt > 0) {
+		memcpy(dst, data, cnt * elsize);
+	}
+	SafeArrayUnaccessData(varr);
+
+	switch (vt) {
+	case VT_I1: return Int8Array::New(buf, 0, cnt);
+	case VT_UI1: return Uint8Array::New(buf, 0, cnt);
+	case VT_I2: return Int16Array::New(buf, 0, cnt);
+	case VT_UI2: return Uint16Array::New(buf, 0, cnt);
+	case VT_I4: case VT_INT: return Int32Array::New(buf, 0, cnt);
+	case VT_UI4: case VT_UINT: return Uint32Array::New(buf, 0, cnt);
+	case VT_R4: return Float32Array::New(buf, 0, cnt);
+	}
+	return Float64Array::New(buf, 0, cnt);
+}
+
+// Field layouts of user-defined types, one per record GUID and isolate
+// Plain scalar fields are read straight from the record memory, the others through IRecordInfo::GetField
+namespace {
+	struct record_layout_t {
+		CComPtr<IRecordInfo> info;
+		std::wstring guid;
+		std::vector<std::wstring> names;
+		std::vector<VARTYPE> types;  // VT_EMPTY for fields read through GetField
+		std::vector<ULONG> offsets;
+		bool numeric;                // every field is a plain number, so arrays can go columnar
+		Persistent<ObjectTemplate, CopyablePersistentTraits<ObjectTemplate>> templ;
+	};
+	thread_local std::map<std::wstring, record_layout_t> record_layouts;
+
+	ULONG ScalarSize(VARTYPE vt) {
+		switch (vt) {
+		case VT_I1: case VT_UI1: return 1;
+		case VT_I2: case VT_UI2: case VT_BOOL: return 2;
+		case VT_I4: case VT_UI4: case VT_INT: case VT_UINT: case VT_R4: return 4;
+		case VT_R8: case VT_DATE: case VT_CY: case VT_I8: case VT_UI8: return 8;
+		}
+		return 0;
+	}
+
+	record_layout_t *RecordLayout(Isolate *isolate, IRecordInfo *info) {
+		GUID guid;
+		wchar_t guid_str[64];
+		if (FAILED(info->GetGuid(&guid)) || StringFromGUID2(guid, guid_str, 64) == 0) return nullptr;
+		auto it = record_layouts.find(guid_str);
+		if (it != record_layouts.end()) return &it->second;
+
+		record_layout_t layout;
+		layout.info = info;
+		layout.guid = guid_str;
+		layout.numeric = true;
+		CComPtr<ITypeInfo> type;
+		TYPEATTR *attr;
+		if (SUCCEEDED(info->GetTypeInfo(&type)) && type && SUCCEEDED(type->GetTypeAttr(&attr))) {
+			for (WORD i = 0; i < attr->cVars; i++) {
+				VARDESC *desc;
+				if FAILED(type->GetVarDesc(i, &desc)) continue;
+				CComBSTR name;
+				UINT cnt;
+				if (desc->varkind == VAR_PERINSTANCE && type->GetNames(desc->memid, &name, 1, &cnt) == S_OK && cnt > 0) {
+					VARTYPE vt = desc->elemdescVar.tdesc.vt;
+					if (ScalarSize(vt) == 0) vt = VT_EMPTY;
+					if (vt == VT_EMPTY || vt == VT_BOOL || vt == VT_DATE || vt == VT_CY) layout.numeric = false;
+					layout.names.push_back(std::wstring(name, name.Length()));
+					layout.types.push_back(vt);
+					layout.offsets.push_back(desc->oInst);
+				}
+				type->ReleaseVarDesc(desc);
+			}
+			type->ReleaseTypeAttr(attr);
+		}
+		else {
+			// no type info, field names only
+			ULONG cnt = 0;
+			if (FAILED(info->GetFieldNames(&cnt, nullptr)) || cnt == 0) return nullptr;
+			std::vector<BSTR> names(cnt);
+			if FAILED(info->GetFieldNames(&cnt, &names[0])) return nullptr;
+			for (ULONG i = 0; i < cnt; i++) {
+				layout.names.push_back(std::wstring(names[i], SysStringLen(names[i])));
+				layout.types.push_back(VT_EMPTY);
+				layout.offsets.push_back(0);
+				SysFreeString(names[i]);
+			}
+			layout.numeric = false;
+		}
+		if (layout.names.empty()) layout.numeric = false;
+
+		Local<ObjectTemplate> templ = ObjectTemplate::New(isolate);
+		for (auto &name : layout.names) {
+			templ->Set(NewCompactString(isolate, name.c_str(), (int)name.length(), NewStringType::kInternalized), Undefined(isolate));
+		}
+		templ->Set(String::NewFromUtf8(isolate, "__record"), NewCompactString(isolate, layout.guid.c_str()), (PropertyAttribute)(ReadOnly | DontEnum));
+		layout.templ.Reset(isolate, templ);
+		return &record_layouts.insert(std::make_pair(layout.guid, layout)).first->second;
+	}
+
+	Local<Value> RecordField(Isolate *isolate, record_layout_t &layout, size_t i, const void *data) {
+		VARTYPE vt = layout.types[i];
+		const char *ptr = (const char*)data + layout.offsets[i];
+		if (vt == VT_I8) return Number::New(isolate, (double)*(const LONGLONG*)ptr);
+		if (vt == VT_UI8) return Number::New(isolate, (double)*(const ULONGLONG*)ptr);
+		if (vt != VT_EMPTY) {
+			VARIANT vi;
+			memset(&vi, 0, sizeof(vi));
+			vi.vt = vt;
+			memcpy(&vi.bVal, ptr, ScalarSize(vt));
+			return Variant2Value(isolate, vi);
+		}
+		CComVariant value;
+		if FAILED(layout.info->GetField((PVOID)data, layout.names[i].c_str(), &value)) return Undefined(isolate);
+		return Variant2ValueOwned(isolate, value, true);
+	}
+
+	Local<Object> RecordObject(Isolate *isolate, record_layout_t &layout, const void *data) {
+		Local<Object> obj = layout.templ.Get(isolate)->NewInstance();
+		for (size_t i = 0; i < layout.names.size(); i++) {
+			obj->Set(NewCompactString(isolate, layout.names[i].c_str(), (int)layout.names[i].length(), NewStringType::kInternalized), RecordField(isolate, layout, i, data));
+		}
+		return obj;
+	}
+
+	// { field: TypedArray } over all records, 64-bit integers as Float64Array
+	// untagged, columns are not a record and are not converted back to one
+	Local<Object> RecordColumns(Isolate *isolate, record_layout_t &layout, const char *data, ULONG size, size_t cnt) {
+		Local<Object> obj = Object::New(isolate);
+		for (size_t f = 0; f < layout.names.size(); f++) {
+			VARTYPE vt = layout.types[f];
+			ULONG elsize = (vt == VT_I8 || vt == VT_UI8) ? sizeof(double) : ScalarSize(vt);
+			Local<ArrayBuffer> buf = ArrayBuffer::New(isolate, cnt * elsize);
+			char *dst = (char*)buf->GetContents().Data();
+			const char *src = data + layout.offsets[f];
+			for (size_t i = 0; i < cnt; i++, src += size, dst += elsize) {
+				if (vt == VT_I8) *(double*)dst = (double)*(const LONGLONG*)src;
+				else if (vt == VT_UI8) *(double*)dst = (double)*(const ULONGLONG*)src;
+				else memcpy(dst, src, elsize);
+			}
+			Local<Value> column;
+			switch (vt) {
+			case VT_I1: column = Int8Array::New(buf, 0, cnt); break;
+			case VT_UI1: column = Uint8Array::New(buf, 0, cnt); break;
+			case VT_I2: column = Int16Array::New(buf, 0, cnt); break;
+			case VT_UI2: column = Uint16Array::New(buf, 0, cnt); break;
+			case VT_I4: case VT_INT: column = Int32Array::New(buf, 0, cnt); break;
+			case VT_UI4: case VT_UINT: column = Uint32Array::New(buf, 0, cnt); break;
+			case VT_R4: column = Float32Array::New(buf, 0, cnt); break;
+			default: column = Float64Array::New(buf, 0, cnt); break;
+			}
+			obj->Set(NewCompactString(isolate, layout.names[f].c_str(), (int)layout.names[f].length()), column);
+		}
+		return obj;
+	}
+}
+
+Local<Value> Record2Value(Isolate *isolate, IRecordInfo *info, const void *data) {
+	if (!info || !data) return Null(isolate);
+	record_layout_t *layout = RecordLayout(isolate, info);
+	if (!layout) return Undefined(isolate);
+	return RecordObject(isolate, *layout, data);
+}
+
+// arrays of records in storage order, columnar when typedArrays is set and every field is numeric
+Local<Value> RecordArray2Value(Isolate *isolate, SAFEARRAY *varr) {
+	CComPtr<IRecordInfo> info;
+	if (FAILED(SafeArrayGetRecordInfo(varr, &info)) || !info) return Null(isolate);
+	record_layout_t *layout = RecordLayout(isolate, info);
+	if (!layout) return Undefined(isolate);
+	size_t cnt = 1;
+	for (USHORT d = 0; d < varr->cDims; d++) cnt *= varr->rgsabound[d].cElements;
+	void *data;
+	if FAILED(SafeArrayAccessData(varr, &data)) return Null(isolate);
+	Local<Value> result;
+	if (layout->numeric && ConvertOptions::Current().typedArrays) {
+		result = RecordColumns(isolate, *layout, (const char*)data, varr->cbElements, cnt);
+	}
+	else {
+		Local<Array> arr = Array::New(isolate, (int)cnt);
+		for (size_t i = 0; i < cnt; i++) {
+			arr->Set((uint32_t)i, RecordObject(isolate, *layout, (const char*)data + i * varr->cbElements));
+		}
+		result = arr;
+	}
+	SafeArrayUnaccessData(varr);
+	return result;
+}
+
+// objects with the __record GUID of a record type already received on this thread
+// a field COM refuses throws, the argument is then left empty
+bool Value2Record(Isolate *isolate, const Local<Object> &obj, VARIANT &var) {
+	if (record_layouts.empty()) return false;
+	Local<Value> guid = obj->Get(String::NewFromUtf8(isolate, "__record"));
+	if (!guid->IsString()) return false;
+	String::Value guid_str(guid);
+	auto it = record_layouts.find(std::wstring((wchar_t*)*guid_str, guid_str.length()));
+	if (it == record_layouts.end()) return false;
+	record_layout_t &layout = it->second;
+	void *data = layout.info->RecordCreate();
+	if (!data) return false;
+	for (auto &name : layout.names) {
+		Local<String> key = NewCompactString(isolate, name.c_str(), (int)name.length());
+		if (!obj->Has(key)) continue;
+		Local<Value> val = obj->Get(key);
+		CComVariant field;
+		Value2Variant(isolate, val, field);
+		HRESULT hrcode = layout.info->PutField(INVOKE_PROPERTYPUT, data, name.c_str(), &field);
+		if FAILED(hrcode) {
+			layout.info->RecordDestroy(data);
+			isolate->ThrowException(DispError(isolate, hrcode, L"PutField", name.c_str()));
+			return true;
+		}
+	}
+	var.vt = VT_RECORD;
+	var.pvRecord = data;
+	var.pRecInfo = layout.info;
+	var.pRecInfo->AddRef();
+	return true;
+}
+
+void ClearRecordLayouts() {
+	record_layouts.clear();
+}
+
+// element of a locked SAFEARRAY, the value is only borrowed
+static Local<Value> SafeArrayItem(Isolate *isolate, const char *ptr, VARTYPE vt, ULONG size) {
+	if (vt == VT_VARIANT) return Variant2Value(isolate, *(const VARIANT*)ptr, true);
+	VARIANT vi;
+	memset(&vi, 0, sizeof(vi));
+	memcpy((vt == VT_DECIMAL) ? (void*)&vi.decVal : (void*)&vi.bVal, ptr, (size <= sizeof(vi)) ? size : sizeof(vi));
+	vi.vt = vt; // DECIMAL overlaps the whole VARIANT including vt
+	return Variant2Value(isolate, vi, true);
+}
+
+static Local<Value> SafeArrayNested(Isolate *isolate, const char *data, VARTYPE vt, ULONG size, const std::vector<ULONG> &shape, const std::vector<size_t> &strides, size_t dim, size_t offset) {
+	Local<Array> arr = Array::New(isolate, (int)shape[dim]);
+	for (ULONG i = 0; i < shape[dim]; i++) {
+		size_t index = offset + i * strides[dim];
+		if (dim + 1 < shape.size()) arr->Set(i, SafeArrayNested(isolate, data, vt, size, shape, strides, dim + 1, index));
+		else arr->Set(i, SafeArrayItem(isolate, data + index * size, vt, size));
+	}
+	return arr;
+}
+
+// N-dimensional arrays: { data: TypedArray, shape, strides } for numeric types when typedArrays is set,
+// nested arrays indexed leftmost dimension first otherwise
+static Local<Value> Variant2ArrayND(Isolate *isolate, SAFEARRAY *varr, VARTYPE vt) {
+	std::vector<ULONG> shape;
+	std::vector<size_t> strides;
+	SafeArrayShape(varr, shape, strides);
+
+	if (ConvertOptions::Current().typedArrays) {
+		Local<Value> typed = SafeArray2TypedArray(isolate, varr, vt);
+		if (!typed.IsEmpty()) {
+			Local<Array> jshape = Array::New(isolate, (int)shape.size());
+			Local<Array> jstrides = Array::New(isolate, (int)shape.size());
+			for (uint32_t d = 0; d < shape.size(); d++) {
+				jshape->Set(d, Number::New(isolate, shape[d]));
+				jstrides->Set(d, Number::New(isolate, (double)strides[d]));
+			}
+			Local<Object> obj = Object::New(isolate);
+			obj->Set(String::NewFromUtf8(isolate, "data"), typed);
+			obj->Set(String::NewFromUtf8(isolate, "shape"), jshape);
+			obj->Set(String::NewFromUtf8(isolate, "strides"), jstrides);
+			return obj;
+		}
+	}
+
+	void *data;
+	if FAILED(SafeArrayAccessData(varr, &data)) return Null(isolate);
+	Local<Value> arr = SafeArrayNested(isolate, (const char*)data, vt, varr->cbElements, shape, strides, 0, 0);
+	SafeArrayUnaccessData(varr);
+	return arr;
+}
+
+static bool IsLazyArray(const VARIANT &v) {
+	uint32_t threshold = ConvertOptions::Current().lazyArrays;
+	if (threshold == 0 || (v.vt & VT_ARRAY) == 0 || (v.vt & VT_TYPEMASK) != VT_VARIANT) return false;
+	SAFEARRAY *varr = (v.vt & VT_BYREF) != 0 ? *v.pparray : v.parray;
+	return varr && varr->cDims == 1 && varr->rgsabound[0].cElements >= threshold;
+}
+
+Local<Value> Variant2Array(Isolate *isolate, const VARIANT &v, bool lazy) {
 	if ((v.vt & VT_ARRAY) == 0) return Null(isolate);
 	SAFEARRAY *varr = (v.vt & VT_BYREF) != 0 ? *v.pparray : v.parray;
-	if (!varr || varr->cDims != 1) return Null(isolate);
+	if (!varr || varr->cDims == 0) return Null(isolate);
 	VARTYPE vt = v.vt & VT_TYPEMASK;
+	if (vt == VT_RECORD) return RecordArray2Value(isolate, varr);
+	if (lazy && IsLazyArray(v)) {
+		// the view keeps its own copy, elements are converted on access
+		CComVariant copy(v);
+		Local<Object> view = VariantObject::NodeCreateView(isolate, copy);
+		if (!view.IsEmpty()) return view;
+	}
+	if (varr->cDims > 1) return Variant2ArrayND(isolate, varr, vt);
+	if (ConvertOptions::Current().typedArrays) {
+		Local<Value> typed = SafeArray2TypedArray(isolate, varr, vt);
+		if (!typed.IsEmpty()) return typed;
+	}
 	LONG cnt = (LONG)varr->rgsabound[0].cElements;
+	LONG lbound = varr->rgsabound[0].lLbound;
 	Local<Array> arr = Array::New(isolate, cnt);
-	for (LONG i = varr->rgsabound[0].lLbound; i < cnt; i++) {
+	for (LONG i = 0; i < cnt; i++) {
 		CComVariant vi;
-		if SUCCEEDED(SafeArrayGetElement(varr, &i, (vt == VT_VARIANT) ? (void*)&vi : (void*)&vi.byref)) {
+		LONG index = lbound + i;
+		if SUCCEEDED(SafeArrayGetElement(varr, &index, (vt == VT_VARIANT) ? (void*)&vi : (void*)&vi.byref)) {
 			if (vt != VT_VARIANT) vi.vt = vt;
-			arr->Set((uint32_t)i, Variant2Value(isolate, vi, true));
+			arr->Set((uint32_t)i, Variant2ValueOwned(isolate, vi, true));
 		}
 	}
 	return arr;
 }
 
+Local<Value> Variant2ValueOwned(Isolate *isolate, VARIANT &v, bool allow_disp) {
+	if (v.vt == VT_BSTR) {
+		Local<String> str = Bstr2StringOwned(isolate, v.bstrVal);
+		if (!v.bstrVal) v.vt = VT_EMPTY;
+		return str;
+	}
+	if ((v.vt & VT_BYREF) == 0 && IsLazyArray(v)) {
+		Local<Object> view = VariantObject::NodeCreateView(isolate, v);
+		if (!view.IsEmpty()) return view;
+	}
+	return Variant2Value(isolate, v, allow_disp);
+}
+
 Local<Value> Variant2Value(Isolate *isolate, const VARIANT &v, bool allow_disp) {
 	if ((v.vt & VT_ARRAY) != 0) return Variant2Array(isolate, v);
 	VARTYPE vt = (v.vt & VT_TYPEMASK);
@@ -143,11 +697,13 @@ Local<Value> Variant2Value(Isolate *isolate, const VARIANT &v, bool allow_disp)
 	}
 	case VT_BSTR: {
         BSTR bstr = by_ref ? (v.pbstrVal ? *v.pbstrVal : nullptr) : v.bstrVal;
-        if (!bstr) return String::Empty(isolate);
-		return String::NewFromTwoByte(isolate, (uint16_t*)bstr);
+		return Bstr2String(isolate, bstr);
     }
 	case VT_VARIANT: 
 		if (v.pvarVal) return Variant2Value(isolate, *v.pvarVal, allow_disp);
+		break;
+	case VT_RECORD:
+		return Record2Value(isolate, v.pRecInfo, v.pvRecord);
 	}
 	return Undefined(isolate);
 }
@@ -205,13 +761,133 @@ Local<Value> Variant2String(Isolate *isolate, const VARIANT &v) {
 		break;
 	default:
 		CComVariant tmp;
-		if (SUCCEEDED(VariantChangeType(&tmp, &v, 0, VT_BSTR)) && tmp.vt == VT_BSTR && v.bstrVal != nullptr) {
-			return String::NewFromTwoByte(isolate, (uint16_t*)v.bstrVal);
+		if (SUCCEEDED(VariantChangeType(&tmp, &v, 0, VT_BSTR)) && tmp.vt == VT_BSTR && tmp.bstrVal != nullptr) {
+			return Variant2ValueOwned(isolate, tmp);
 		}
 	}
 	return String::NewFromUtf8(isolate, buf, String::kNormalString);
 }
 
+// TypedArrays and Buffers become SAFEARRAYs of their element type filled by one copy
+// a different requested element type or a strided view is converted item by item
+// shape is leftmost dimension first, strides in elements (column-major contiguous by default)
+void TypedArray2Variant(const Local<ArrayBufferView> &view, VARIANT &var, VARTYPE vt, const std::vector<ULONG> *shape, const std::vector<size_t> *strides) {
+	VARTYPE elvt;
+	size_t elsize;
+	if (view->IsFloat64Array()) { elvt = VT_R8; elsize = 8; }
+	else if (view->IsFloat32Array()) { elvt = VT_R4; elsize = 4; }
+	else if (view->IsInt32Array()) { elvt = VT_I4; elsize = 4; }
+	else if (view->IsUint32Array()) { elvt = VT_UI4; elsize = 4; }
+	else if (view->IsInt16Array()) { elvt = VT_I2; elsize = 2; }
+	else if (view->IsUint16Array()) { elvt = VT_UI2; elsize = 2; }
+	else if (view->IsInt8Array()) { elvt = VT_I1; elsize = 1; }
+	else { elvt = VT_UI1; elsize = 1; } // Uint8Array, Uint8ClampedArray, Buffer, DataView
+
+	size_t available = view->ByteLength() / elsize;
+	size_t cnt = available;
+	std::vector<SAFEARRAYBOUND> bounds;
+	bool contiguous = true;
+	if (shape && !shape->empty()) {
+		cnt = 1;
+		for (size_t d = 0; d < shape->size(); d++) {
+			SAFEARRAYBOUND bound = { (*shape)[d], 0 };
+			bounds.push_back(bound);
+			if (strides && d < strides->size() && (*strides)[d] != cnt) contiguous = false;
+			cnt *= (*shape)[d];
+		}
+	}
+	else {
+		SAFEARRAYBOUND bound = { (ULONG)cnt, 0 };
+		bounds.push_back(bound);
+	}
+
+	// source element of destination index i, walking the destination in storage order
+	auto source = [&](size_t i) -> size_t {
+		if (contiguous) return i;
+		size_t offset = 0;
+		for (size_t d = 0; d < shape->size(); d++) {
+			offset += (i % (*shape)[d]) * (*strides)[d];
+			i /= (*shape)[d];
+		}
+		return offset;
+	};
+	// strides are non-negative, so the farthest element sits at the last index of every dimension
+	if (cnt > 0) {
+		double last = 0;
+		if (contiguous) last = (double)(cnt - 1);
+		else for (size_t d = 0; d < shape->size(); d++) last += (double)((*shape)[d] - 1) * (double)(*strides)[d];
+		if (last >= (double)available) {
+			var.vt = VT_EMPTY;
+			return;
+		}
+	}
+
+	VARTYPE arrvt = (vt == VT_EMPTY) ? elvt : vt;
+	var.vt = VT_ARRAY | arrvt;
+	var.parray = SafeArrayCreate(arrvt, (UINT)bounds.size(), &bounds[0]);
+	void *data;
+	if (!var.parray || FAILED(SafeArrayAccessData(var.parray, &data))) {
+		VariantClear(&var);
+		return;
+	}
+	if (arrvt == elvt && contiguous) {
+		if (cnt > 0) view->CopyContents(data, cnt * elsize);
+	}
+	else {
+		std::vector<char> src(available * elsize);
+		if (available > 0) view->CopyContents(&src[0], available * elsize);
+		size_t dstsize = var.parray->cbElements;
+		for (size_t i = 0; i < cnt; i++) {
+			size_t from = source(i);
+			if (arrvt == elvt) {
+				memcpy((char*)data + i * dstsize, &src[from * elsize], elsize);
+				continue;
+			}
+			CComVariant item;
+			item.vt = elvt;
+			memcpy(&item.bVal, &src[from * elsize], elsize);
+			if (arrvt == VT_VARIANT) {
+				VariantCopy(&((VARIANT*)data)[i], &item);
+				continue;
+			}
+			if FAILED(VariantChangeType(&item, &item, 0, arrvt)) continue;
+			// the array takes ownership of the converted value
+			memcpy((char*)data + i * dstsize, (arrvt == VT_DECIMAL) ? (void*)&item.decVal : (void*)&item.bVal, dstsize);
+			item.vt = VT_EMPTY;
+		}
+	}
+	SafeArrayUnaccessData(var.parray);
+}
+
+// { data: TypedArray, shape: [...], strides: [...] } -> N-dimensional SAFEARRAY
+bool ArrayDescriptor2Variant(const Local<Object> &obj, VARIANT &var, VARTYPE vt) {
+	Local<Value> data = Nan::Get(obj, Nan::New("data").ToLocalChecked()).ToLocalChecked();
+	Local<Value> shape = Nan::Get(obj, Nan::New("shape").ToLocalChecked()).ToLocalChecked();
+	if (!data->IsArrayBufferView() || !shape->IsArray()) return false;
+	Local<Array> jshape = Local<Array>::Cast(shape);
+	std::vector<ULONG> dims(jshape->Length());
+	for (uint32_t d = 0; d < dims.size(); d++) {
+		Local<Value> dim = Nan::Get(jshape, d).ToLocalChecked();
+		if (!dim->IsUint32()) return false;
+		dims[d] = dim->Uint32Value();
+	}
+	std::vector<size_t> steps;
+	Local<Value> strides = Nan::Get(obj, Nan::New("strides").ToLocalChecked()).ToLocalChecked();
+	if (strides->IsArray()) {
+		Local<Array> jstrides = Local<Array>::Cast(strides);
+		if (jstrides->Length() != dims.size()) return false;
+		steps.resize(dims.size());
+		for (uint32_t d = 0; d < steps.size(); d++) {
+			// element counts, negative or fractional strides are not supported
+			Local<Value> step = Nan::Get(jstrides, d).ToLocalChecked();
+			if (!step->IsUint32()) return false;
+			steps[d] = step->Uint32Value();
+		}
+	}
+	TypedArray2Variant(Local<ArrayBufferView>::Cast(data), var, vt, &dims, steps.empty() ? nullptr : &steps);
+	return true;
+}
+
 void Value2Variant(Isolate *isolate, Local<Value> &val, VARIANT &var, VARTYPE vt) {
 	if (val.IsEmpty() || val->IsUndefined()) {
 		var.vt = VT_EMPTY;
@@ -239,6 +915,10 @@ void Value2Variant(Isolate *isolate, Local<Value> &val, VARIANT &var, VARTYPE vt
 		var.vt = VT_BOOL;
 		var.boolVal = val->BooleanValue() ? VARIANT_TRUE : VARIANT_FALSE;
 	}
+	else if (val->IsArrayBufferView() && (vt != VT_NULL)) {
+		TypedArray2Variant(Local<ArrayBufferView>::Cast(val), var, vt);
+		vt = VT_EMPTY;
+	}
 	else if (val->IsArray() && (vt != VT_NULL)) {
 		Local<Array> arr = v8::Local<Array>::Cast(val);
 		uint32_t len = arr->Length();
@@ -258,7 +938,16 @@ void Value2Variant(Isolate *isolate, Local<Value> &val, VARIANT &var, VARTYPE vt
 	}
 	else if (val->IsObject()) {
 		Local<Object> obj = val->ToObject();
-		if (!DispObject::GetValueOf(isolate, obj, var) && !VariantObject::GetValueOf(isolate, obj, var)) {
+		bool converted = DispObject::GetValueOf(isolate, obj, var) || VariantObject::GetValueOf(isolate, obj, var);
+		if (!converted && vt != VT_NULL && ArrayDescriptor2Variant(obj, var, vt)) {
+			converted = true;
+			vt = VT_EMPTY;
+		}
+		if (!converted && Value2Record(isolate, obj, var)) {
+			converted = true;
+			vt = VT_EMPTY;
+		}
+		if (!converted) {
 			var.vt = VT_DISPATCH;
 			var.pdispVal = new DispObjectImpl(obj);
 			var.pdispVal->AddRef();
@@ -267,7 +956,7 @@ void Value2Variant(Isolate *isolate, Local<Value> &val, VARIANT &var, VARTYPE vt
 	else {
 		String::Value str(val);
 		var.vt = VT_BSTR;
-		var.bstrVal = (str.length() > 0) ? SysAllocString((LPOLESTR)*str) : 0;
+		var.bstrVal = (str.length() > 0) ? CallArena::AllocString((LPOLESTR)*str, (UINT)str.length()) : 0;
 	}
 	if (vt != VT_EMPTY && vt != VT_NULL && vt != VT_VARIANT) {
 		if FAILED(VariantChangeType(&var, &var, 0, vt))
@@ -332,6 +1021,131 @@ bool VariantDispGet(VARIANT *v, IDispatch **pdisp) {
     return false;
 }
 
+//-------------------------------------------------------------------------------------------------------
+
+HRESULT PropertyBag::Read(IDispatch *disp, LPOLESTR names_method, LPOLESTR value_method) {
+	Clear();
+	if (!disp) return E_INVALIDARG;
+	DISPID id_names, id_value;
+	HRESULT hrcode = DispFind(disp, names_method, &id_names);
+	if SUCCEEDED(hrcode) hrcode = DispFind(disp, value_method, &id_value);
+	CComVariant list;
+	if SUCCEEDED(hrcode) hrcode = DispInvoke(disp, id_names, 0, 0, &list, DISPATCH_METHOD);
+	if FAILED(hrcode) return hrcode;
+
+	if ((list.vt & VT_ARRAY) == 0) return DISP_E_TYPEMISMATCH;
+	SAFEARRAY *varr = (list.vt & VT_BYREF) != 0 ? *list.pparray : list.parray;
+	VARTYPE vt = list.vt & VT_TYPEMASK;
+	if (!varr || varr->cDims != 1 || (vt != VT_BSTR && vt != VT_VARIANT)) return DISP_E_TYPEMISMATCH;
+	void *data;
+	hrcode = SafeArrayAccessData(varr, &data);
+	if FAILED(hrcode) return hrcode;
+	ULONG cnt = varr->rgsabound[0].cElements;
+	names.reserve(cnt);
+	for (ULONG i = 0; i < cnt; i++) {
+		BSTR name = nullptr;
+		if (vt == VT_BSTR) name = ((BSTR*)data)[i];
+		else {
+			VARIANT &item = ((VARIANT*)data)[i];
+			if (item.vt == VT_BSTR) name = item.bstrVal;
+		}
+		if (name) names.emplace_back(name, SysStringLen(name));
+	}
+	SafeArrayUnaccessData(varr);
+
+	values.resize(names.size());
+	for (size_t i = 0; i < names.size(); i++) {
+		CComVariant arg((LPOLESTR)names[i].c_str());
+		hrcode = DispInvoke(disp, id_value, 1, &arg, &values[i], DISPATCH_METHOD);
+		if FAILED(hrcode) break;
+	}
+	if FAILED(hrcode) Clear();
+	return hrcode;
+}
+
+Local<Object> PropertyBag::ToObject(Isolate *isolate) const {
+	Local<Object> obj = Object::New(isolate);
+	for (size_t i = 0; i < names.size(); i++) {
+		obj->Set(Bstr2String(isolate, names[i].c_str(), (int)names[i].length()), Variant2Value(isolate, values[i], true));
+	}
+	return obj;
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+namespace {
+	struct call_arena_t {
+		std::vector<std::vector<CComVariant>*> vectors;
+		std::vector<BSTR> strings;
+		uint64_t calls, vectors_created, strings_allocated, strings_reused;
+
+		inline call_arena_t() : calls(0), vectors_created(0), strings_allocated(0), strings_reused(0) {}
+		~call_arena_t() {
+			for (auto items : vectors) delete items;
+			for (auto bstr : strings) SysFreeString(bstr);
+		}
+	};
+	thread_local call_arena_t call_arena;
+}
+
+std::vector<CComVariant> &CallArena::Acquire() {
+	if (call_arena.vectors.empty()) {
+		call_arena.vectors_created++;
+		return *(new std::vector<CComVariant>());
+	}
+	std::vector<CComVariant> *items = call_arena.vectors.back();
+	call_arena.vectors.pop_back();
+	return *items;
+}
+
+void CallArena::Release(std::vector<CComVariant> &items) {
+	for (auto &item : items) {
+		if (item.vt == VT_BSTR && item.bstrVal && call_arena.strings.size() < max_strings && SysStringLen(item.bstrVal) <= max_string_length) {
+			call_arena.strings.push_back(item.bstrVal);
+			item.vt = VT_EMPTY;
+		}
+	}
+	items.clear();
+	if (call_arena.vectors.size() < max_vectors) call_arena.vectors.push_back(&items);
+	else delete &items;
+}
+
+BSTR CallArena::AllocString(const wchar_t *str, UINT len) {
+	if (len <= max_string_length && !call_arena.strings.empty()) {
+		BSTR bstr = call_arena.strings.back();
+		call_arena.strings.pop_back();
+		if (SysReAllocStringLen(&bstr, str, len)) {
+			call_arena.strings_reused++;
+			return bstr;
+		}
+		SysFreeString(bstr);
+	}
+	call_arena.strings_allocated++;
+	return SysAllocStringLen(str, len);
+}
+
+void CallArena::CountInvoke() {
+	call_arena.calls++;
+}
+
+// only what the arena hands out is counted, temporaries outside it are not
+Local<Object> CallArena::Stats(Isolate *isolate) {
+	uint64_t allocations = call_arena.vectors_created + call_arena.strings_allocated;
+	Local<Object> obj = Object::New(isolate);
+	obj->Set(String::NewFromUtf8(isolate, "calls"), Number::New(isolate, (double)call_arena.calls));
+	obj->Set(String::NewFromUtf8(isolate, "vectorsCreated"), Number::New(isolate, (double)call_arena.vectors_created));
+	obj->Set(String::NewFromUtf8(isolate, "stringsAllocated"), Number::New(isolate, (double)call_arena.strings_allocated));
+	obj->Set(String::NewFromUtf8(isolate, "stringsReused"), Number::New(isolate, (double)call_arena.strings_reused));
+	obj->Set(String::NewFromUtf8(isolate, "arenaAllocationsPerCall"), Number::New(isolate, call_arena.calls ? (double)allocations / call_arena.calls : 0.));
+	return obj;
+}
+
+void CallArena::ResetStats() {
+	call_arena.calls = call_arena.vectors_created = call_arena.strings_allocated = call_arena.strings_reused = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+
 /*
 * Microsoft OLE Date type:
 * https://docs.microsoft.com/en-us/previous-versions/visualstudio/visual-studio-2008/82ab7w69(v=vs.90)
@@ -32,6 +32,11 @@
 #endif
 //-------------------------------------------------------------------------------------------------------
 
+// narrows UTF-16 to Latin-1 into dst, stops with false at the first code unit above 0xFF
+bool NarrowLatin1(const wchar_t *src, size_t len, uint8_t *dst);
+// one-byte V8 string when the text fits Latin-1 (and compactStrings is on), two-byte otherwise; len < 0 means zero terminated
+Local<String> NewCompactString(Isolate *isolate, const wchar_t *str, int len = -1, NewStringType type = NewStringType::kNormal);
+
 Local<String> GetWin32ErroroMessage(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2 = 0, LPCOLESTR desc = 0);
 
 inline Local<Value> Win32Error(Isolate *isolate, HRESULT hrcode, LPCOLESTR id = 0, LPCOLESTR msg = 0) {
@@ -52,8 +57,8 @@ inline Local<Value> DispError(Isolate *isolate, HRESULT hrcode, LPCOLESTR id = 0
 	if (except) {
 		if (except->scode != 0) obj->Set(String::NewFromUtf8(isolate, "code"), Integer::New(isolate, except->scode));
 		else if (except->wCode != 0) obj->Set(String::NewFromUtf8(isolate, "code"), Integer::New(isolate, except->wCode));
-		if (except->bstrSource != 0) obj->Set(String::NewFromUtf8(isolate, "source"), String::NewFromTwoByte(isolate, (uint16_t*)except->bstrSource));
-		if (except->bstrDescription != 0) obj->Set(String::NewFromUtf8(isolate, "description"), String::NewFromTwoByte(isolate, (uint16_t*)except->bstrDescription));
+		if (except->bstrSource != 0) obj->Set(String::NewFromUtf8(isolate, "source"), NewCompactString(isolate, except->bstrSource));
+		if (except->bstrDescription != 0) obj->Set(String::NewFromUtf8(isolate, "description"), NewCompactString(isolate, except->bstrDescription));
 	}
 	return err;
 }
@@ -145,9 +150,120 @@ inline INTTYPE Variant2Int(const VARIANT &v, const INTTYPE def) {
     return SUCCEEDED(VariantChangeType(&dst, &v, 0, VT_INT)) ? (INTTYPE)dst.intVal : def;
 }
 
-Local<Value> Variant2Array(Isolate *isolate, const VARIANT &v);
+inline double Variant2Double(const VARIANT &v, double def) {
+	VARTYPE vt = (v.vt & VT_TYPEMASK);
+	bool by_ref = (v.vt & VT_BYREF) != 0;
+	switch (vt) {
+	case VT_EMPTY:
+	case VT_NULL:
+		return def;
+	case VT_R8:
+		return by_ref ? *v.pdblVal : v.dblVal;
+	case VT_R4:
+		return by_ref ? *v.pfltVal : v.fltVal;
+	case VT_VARIANT:
+		if (v.pvarVal) return Variant2Double(*v.pvarVal, def);
+		return def;
+	}
+	CComVariant dst;
+	return SUCCEEDED(VariantChangeType(&dst, &v, 0, VT_R8)) ? dst.dblVal : def;
+}
+
+// Conversion switches of the calling isolate, see ole.options()
+//   typedArrays: 1-D numeric SAFEARRAYs become TypedArrays filled by one block copy
+//   internStrings: short strings are looked up in a bounded table of internalized strings
+//   internCapacity: size of that table
+//   externalStrings: owned BSTRs of at least this many characters become external strings, 0 turns it off
+//   compactStrings: Latin-1 text becomes one-byte strings
+//   lazyArrays: 1-D VARIANT arrays of at least this many elements become Variant views converted on access, 0 turns it off
+//   lazyArguments: member wrappers passed as arguments are read again on every call instead of keeping the object they resolved to
+struct ConvertOptions {
+	bool typedArrays;
+	bool internStrings;
+	uint32_t internCapacity;
+	uint32_t externalStrings;
+	bool compactStrings;
+	uint32_t lazyArrays;
+	bool lazyArguments;
+
+	inline ConvertOptions() : typedArrays(false), internStrings(false), internCapacity(4096), externalStrings(64 * 1024), compactStrings(true), lazyArrays(0), lazyArguments(false) {}
+	void Read(const Local<Value> &val);
+	Local<Object> ToObject(Isolate *isolate) const;
+	static ConvertOptions &Current();
+
+	// overrides the current options for one conversion
+	class Scope {
+	public:
+		inline Scope(const ConvertOptions &opts) : saved(Current()) { Current() = opts; }
+		inline ~Scope() { Current() = saved; }
+	private:
+		ConvertOptions saved;
+	};
+};
+
+// Short repeated strings (result keys, test names, units, 'Passed') mapped to internalized V8 strings
+// Direct-mapped on a content hash, so the table never grows past its capacity; per isolate
+class StringCache {
+public:
+	enum { max_length = 64 };
+	static StringCache &Current();
+
+	Local<String> Get(Isolate *isolate, const wchar_t *str, int len);
+	void Resize(uint32_t capacity);
+	void Clear();
+	Local<Object> Stats(Isolate *isolate) const;
+	inline void ResetStats() { hits = misses = 0; }
+
+	uint64_t hits, misses;
+
+private:
+	inline StringCache() : hits(0), misses(0) {}
+	struct slot_t {
+		std::wstring key;
+		Persistent<String, CopyablePersistentTraits<String>> value;
+	};
+	std::vector<slot_t> slots_;
+};
+
+Local<String> Bstr2String(Isolate *isolate, const wchar_t *str, int len);
+inline Local<String> Bstr2String(Isolate *isolate, BSTR bstr) {
+	return Bstr2String(isolate, bstr, bstr ? (int)SysStringLen(bstr) : 0);
+}
+
+// Large BSTR exposed to V8 in place, freed with SysFreeString when the string is collected
+class BstrResource : public String::ExternalStringResource {
+public:
+	BstrResource(Isolate *isolate, BSTR bstr);
+	~BstrResource();
+	virtual const uint16_t *data() const { return (const uint16_t*)bstr_; }
+	virtual size_t length() const { return length_; }
+	// gives the BSTR back when V8 did not adopt the resource
+	inline BSTR Detach() { BSTR bstr = bstr_; bstr_ = nullptr; return bstr; }
+
+private:
+	Isolate *isolate_;
+	BSTR bstr_;
+	size_t length_;
+};
+
+// takes the BSTR when it is large enough to be worth an external string, bstr is null afterwards then
+Local<String> Bstr2StringOwned(Isolate *isolate, BSTR &bstr);
+
+Local<Value> SafeArray2TypedArray(Isolate *isolate, SAFEARRAY *varr, VARTYPE vt);
+// VT_RECORD: plain objects carrying the record GUID in a hidden __record property, so they can be passed back
+Local<Value> Record2Value(Isolate *isolate, IRecordInfo *info, const void *data);
+Local<Value> RecordArray2Value(Isolate *isolate, SAFEARRAY *varr);
+bool Value2Record(Isolate *isolate, const Local<Object> &obj, VARIANT &var);
+void ClearRecordLayouts();
+// lazy = false converts this array eagerly even when lazyArrays applies to it
+Local<Value> Variant2Array(Isolate *isolate, const VARIANT &v, bool lazy = true);
 Local<Value> Variant2Value(Isolate *isolate, const VARIANT &v, bool allow_disp = false);
+// for results owned by the caller, a large string may be moved out of v
+Local<Value> Variant2ValueOwned(Isolate *isolate, VARIANT &v, bool allow_disp = false);
 Local<Value> Variant2String(Isolate *isolate, const VARIANT &v);
+size_t SafeArrayShape(SAFEARRAY *varr, std::vector<ULONG> &shape, std::vector<size_t> &strides);
+void TypedArray2Variant(const Local<ArrayBufferView> &view, VARIANT &var, VARTYPE vt = VT_EMPTY, const std::vector<ULONG> *shape = nullptr, const std::vector<size_t> *strides = nullptr);
+bool ArrayDescriptor2Variant(const Local<Object> &obj, VARIANT &var, VARTYPE vt = VT_EMPTY);
 void Value2Variant(Isolate *isolate, Local<Value> &val, VARIANT &var, VARTYPE vt = VT_EMPTY);
 bool Value2Unknown(Isolate *isolate, Local<Value> &val, IUnknown **unk);
 bool VariantUnkGet(VARIANT *v, IUnknown **unk);
@@ -166,34 +282,69 @@ inline bool v8val2bool(const Local<Value> &v, bool def) {
 
 //-------------------------------------------------------------------------------------------------------
 
+// Per-thread reuse of synchronous call temporaries
+// Argument vectors keep their capacity between calls, and in-argument BSTRs, which the callee never owns,
+// go back to a small cache and are reallocated in place for the next string argument
+class CallArena {
+public:
+	enum { max_vectors = 8, max_strings = 32, max_string_length = 256 };
+	static std::vector<CComVariant> &Acquire();
+	static void Release(std::vector<CComVariant> &items);
+	static BSTR AllocString(const wchar_t *str, UINT len);
+	// one IDispatch::Invoke made on this thread
+	static void CountInvoke();
+	static Local<Object> Stats(Isolate *isolate);
+	static void ResetStats();
+};
+
 class VarArguments {
 public:
-	std::vector<CComVariant> items;
-	VarArguments() {}
-	VarArguments(Isolate *isolate, Local<Value> value) {
+	std::vector<CComVariant> &items;
+	VarArguments() : items(CallArena::Acquire()) {}
+	VarArguments(Isolate *isolate, Local<Value> value) : items(CallArena::Acquire()) {
 		items.resize(1);
 		Value2Variant(isolate, value, items[0]);
 	}
-	VarArguments(Isolate *isolate, const FunctionCallbackInfo<Value> &args) {
+	VarArguments(Isolate *isolate, const FunctionCallbackInfo<Value> &args) : items(CallArena::Acquire()) {
 		int argcnt = args.Length();
 		items.resize(argcnt);
 		for (int i = 0; i < argcnt; i ++)
 			Value2Variant(isolate, args[argcnt - i - 1], items[i]);
 	}
+	~VarArguments() { CallArena::Release(items); }
+
+private:
+	VarArguments(const VarArguments&);
+	VarArguments &operator=(const VarArguments&);
 };
 
 class NodeArguments {
 public:
 	std::vector<Local<Value>> items;
-	NodeArguments(Isolate *isolate, DISPPARAMS *pDispParams, bool allow_disp) {
+	NodeArguments(Isolate *isolate, DISPPARAMS *pDispParams, bool allow_disp, int skip = -1) {
 		UINT argcnt = pDispParams->cArgs;
 		items.resize(argcnt);
 		for (UINT i = 0; i < argcnt; i++) {
+			if ((int)i == skip) continue;
 			items[i] = Variant2Value(isolate, pDispParams->rgvarg[argcnt - i - 1], allow_disp);
 		}
 	}
 };
 
+//-------------------------------------------------------------------------------------------------------
+// Name/value collection read from an IDispatch exposing GetItemNames() and GetValue(name)
+// Reading touches COM only, so it may run on any thread; ToObject must run on the isolate thread
+
+class PropertyBag {
+public:
+	std::vector<std::wstring> names;
+	std::vector<CComVariant> values;
+
+	HRESULT Read(IDispatch *disp, LPOLESTR names_method = L"GetItemNames", LPOLESTR value_method = L"GetValue");
+	Local<Object> ToObject(Isolate *isolate) const;
+	inline void Clear() { names.clear(); values.clear(); }
+};
+
 
 double FromOleDate(double);
 double ToOleDate(double);
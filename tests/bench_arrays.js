@@ -0,0 +1,50 @@
+const ole = require('../lib/bindings')
+
+// SAFEARRAY -> JS conversion of double arrays, element by element vs one block copy
+function bench (size, typedArrays) {
+  let src = new Array(size)
+  for (let i = 0; i < size; i++) src[i] = i * 0.5
+  const arr = new ole.Variant(src, 'double')
+
+  const rounds = Math.max(1, Math.floor(1e7 / size))
+  const start = process.hrtime()
+  let out
+  for (let i = 0; i < rounds; i++) out = arr.valueOf({ typedArrays })
+  const [sec, ns] = process.hrtime(start)
+  const ms = (sec * 1e3 + ns / 1e6) / rounds
+
+  if (out.length !== size || out[size - 1] !== src[size - 1]) throw new Error('conversion mismatch')
+  return ms
+}
+
+// JS -> SAFEARRAY conversion, plain array vs Float64Array
+function benchUpload (size, typed) {
+  let src = typed ? new Float64Array(size) : new Array(size)
+  for (let i = 0; i < size; i++) src[i] = i * 0.5
+
+  const rounds = Math.max(1, Math.floor(1e7 / size))
+  const start = process.hrtime()
+  let arr
+  for (let i = 0; i < rounds; i++) arr = new ole.Variant(src)
+  const [sec, ns] = process.hrtime(start)
+  const ms = (sec * 1e3 + ns / 1e6) / rounds
+
+  if (arr.length !== size) throw new Error('conversion mismatch')
+  return ms
+}
+
+// indexing an empty array is out of range, not a crash
+function checkEmpty () {
+  const empty = new ole.Variant([], 'pstring')
+  if (empty.length !== 0 || empty[0] !== undefined) throw new Error('empty array indexing')
+}
+
+function report (name, size, plain, typed) {
+  console.log(`${name}\t${size}\tarray ${plain.toFixed(3)} ms\ttyped ${typed.toFixed(3)} ms\tx${(plain / typed).toFixed(1)}`)
+}
+
+checkEmpty()
+for (let size of [1e3, 1e4, 1e5, 1e6, 1e7]) {
+  report('read', size, bench(size, false), bench(size, true))
+  report('write', size, benchUpload(size, false), benchUpload(size, true))
+}
@@ -0,0 +1,20 @@
+const ole = require('../lib/bindings')
+
+// allocator calls and time per synchronous invoke, Scripting.Dictionary as a cheap in-process target
+const dict = new ole.Object('Scripting.Dictionary')
+const keys = []
+for (let i = 0; i < 1000; i++) keys.push(`Param_${i}`)
+for (let key of keys) dict.Add(key, 'value')
+
+function bench (name, rounds, fn) {
+  ole.callStats(true)
+  const start = process.hrtime()
+  for (let i = 0; i < rounds; i++) fn(i)
+  const [sec, ns] = process.hrtime(start)
+  const stats = ole.callStats()
+  console.log(`${name}\t${((sec * 1e9 + ns) / rounds / 1e3).toFixed(2)} us/call\t${stats.arenaAllocationsPerCall.toFixed(3)} arena allocations/call\t(${stats.stringsReused} strings reused)`)
+}
+
+bench('Exists', 1e5, i => dict.Exists(keys[i % keys.length]))
+bench('Item', 1e5, i => dict.Item(keys[i % keys.length]))
+bench('Count', 1e5, () => dict.Count)
@@ -0,0 +1,38 @@
+const ole = require('../lib/bindings')
+
+// BSTR -> JS string conversion on a TEST_RESULT-like mix: few distinct keys and verdicts,
+// a moderate set of test names and units, and unique measured values
+const keys = ['TestName', 'TestResult', 'OutputParam_MeasuredValue', 'OutputParam_Units', 'LowerLimit', 'UpperLimit']
+const verdicts = ['Passed', 'Passed', 'Passed', 'Failed']
+const units = ['dBm', 'mA', 'V', 'Hz', 'ms']
+
+function messages (count) {
+  let items = []
+  for (let i = 0; i < count; i++) {
+    items.push(new ole.Variant(keys[i % keys.length], 'string'))
+    items.push(new ole.Variant(`Test_${i % 500}`, 'string'))
+    items.push(new ole.Variant(verdicts[i % verdicts.length], 'string'))
+    items.push(new ole.Variant(units[i % units.length], 'string'))
+    items.push(new ole.Variant(String(Math.random() * 100), 'string'))
+  }
+  return items
+}
+
+function bench (items, internStrings, compactStrings = true) {
+  ole.options({ internStrings, compactStrings })
+  ole.stringStats(true)
+  global.gc && global.gc()
+  const heap = process.memoryUsage().heapUsed
+  const start = process.hrtime()
+  let out = items.map(v => v.valueOf())
+  const [sec, ns] = process.hrtime(start)
+  const grown = process.memoryUsage().heapUsed - heap
+  const stats = ole.stringStats()
+  console.log(`intern ${internStrings}\tcompact ${compactStrings}\t${(sec * 1e3 + ns / 1e6).toFixed(1)} ms\theap +${(grown / 1048576).toFixed(1)} MB\thit rate ${(stats.hitRate * 100).toFixed(1)}%\t(${out.length} strings)`)
+}
+
+// run with --expose-gc for stable heap figures
+const items = messages(200000)
+bench(items, false, false)
+bench(items, false)
+bench(items, true)